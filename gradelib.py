@@ -1,6 +1,7 @@
 from __future__ import print_function
 
 import sys, os, re, time, socket, select, subprocess, errno, shutil, traceback
+import binascii, hashlib, json
 from subprocess import check_call, Popen
 from optparse import OptionParser
 
@@ -14,9 +15,15 @@ __all__ += ["test", "end_part", "run_tests", "get_current_test"]
 
 TESTS = []
 TOTAL = POSSIBLE = 0
+FAILED = 0
 PART_TOTAL = PART_POSSIBLE = 0
 CURRENT_TEST = None
 
+# In parallel mode (run_tests -j), each worker process runs its tests
+# on QEMU instance INSTANCE (1, 2, ...), with its own snapshot of the
+# object directory.  None when running serially.
+INSTANCE = None
+
 def test(points, title=None, parent=None):
     """Decorator for declaring test functions.  If title is None, the
     title of the test will be derived from the function name by
@@ -31,7 +38,7 @@ def test(points, title=None, parent=None):
             title = "  " + title
 
         def run_test():
-            global TOTAL, POSSIBLE, CURRENT_TEST
+            global TOTAL, POSSIBLE, FAILED, CURRENT_TEST
 
             # Handle test dependencies
             if run_test.complete:
@@ -53,7 +60,9 @@ def test(points, title=None, parent=None):
 
             # Display and handle test result
             POSSIBLE += points
-            if points:
+            # Tests worth no points still fail the run, so that
+            # checks like boot time regressions aren't missed.
+            if points or fail:
                 print("%s" % \
                     (color("red", "FAIL") if fail else color("green", "OK")), end=' ')
             if time.time() - start > 0.1:
@@ -61,6 +70,7 @@ def test(points, title=None, parent=None):
             print()
             if fail:
                 print("    %s" % fail.replace("\n", "\n    "))
+                FAILED += 1
             else:
                 TOTAL += points
             for callback in run_test.on_finish:
@@ -70,6 +80,7 @@ def test(points, title=None, parent=None):
         # Record test metadata on the test wrapper function
         run_test.__name__ = fn.__name__
         run_test.title = title
+        run_test.parent = parent
         run_test.complete = False
         run_test.on_finish = []
         TESTS.append(run_test)
@@ -91,12 +102,19 @@ def run_tests():
 
     # Handle command line
     global options
-    parser = OptionParser(usage="usage: %prog [-v] [filters...]")
+    parser = OptionParser(usage="usage: %prog [-v] [-j N] [filters...]")
     parser.add_option("-v", "--verbose", action="store_true",
                       help="print commands")
     parser.add_option("--color", choices=["never", "always", "auto"],
                       default="auto", help="never, always, or auto")
+    parser.add_option("-j", "--jobs", type="int", default=1,
+                      help="run up to N QEMUs at once [%default]")
+    parser.add_option("--no-snapshot", dest="snapshot", action="store_false",
+                      default=True, help="boot JOS from scratch every time")
     (options, args) = parser.parse_args()
+    # Decide now, since parallel workers' output goes to a file
+    if options.color == "auto":
+        options.color = "always" if os.isatty(1) else "never"
 
     # Start with a full build to catch build errors
     make()
@@ -106,17 +124,140 @@ def run_tests():
 
     # Run tests
     limit = list(map(str.lower, args))
+    def selected(test):
+        return not limit or any(l in test.title.lower() for l in limit)
     try:
-        for test in TESTS:
-            if not limit or any(l in test.title.lower() for l in limit):
-                test()
+        if options.jobs > 1:
+            run_parallel(selected, options.jobs)
+        else:
+            for test in TESTS:
+                if selected(test):
+                    test()
         if not limit:
             print("Score: %d/%d" % (TOTAL, POSSIBLE))
+        if SNAPSHOT_BOOTS:
+            print("Boot snapshot: skipped %d boot%s, saving %.1fs" %
+                  (SNAPSHOT_BOOTS, "s" if SNAPSHOT_BOOTS > 1 else "",
+                   SNAPSHOT_SECS))
     except KeyboardInterrupt:
         pass
-    if TOTAL < POSSIBLE:
+    if TOTAL < POSSIBLE or FAILED:
         sys.exit(1)
 
+def run_parallel(selected, jobs):
+    """Run the selected tests on up to 'jobs' QEMU instances at once.
+
+    Tests that share a root test (through their parent chains) form a
+    group, which runs in a worker process of its own.  Groups are
+    independent, so they may finish in any order; their output is
+    buffered, and printed and scored in the order the tests were
+    declared, so the report reads the same as a serial run's.  An
+    end_part waits for the groups before it."""
+
+    # Every instance gets a copy of the freshly built object directory
+    # and a GDB port of its own.
+    make(".gdbinit")
+    ports = {}
+    for i in range(1, jobs + 1):
+        maybe_rmtree(objdir(i))
+        shutil.copytree(objdir(None), objdir(i), symlinks=True)
+        ports[i] = free_port()
+
+    def start_worker(group, instance):
+        sys.stdout.flush()
+        sys.stderr.flush()
+        pid = os.fork()
+        if pid:
+            return pid
+
+        global INSTANCE, TOTAL, POSSIBLE, FAILED
+        global SNAPSHOT_BOOTS, SNAPSHOT_SECS
+        INSTANCE = instance
+        QEMU._GDBPORT = ports[instance]
+        TOTAL = POSSIBLE = FAILED = 0
+        SNAPSHOT_BOOTS, SNAPSHOT_SECS = 0, 0.0
+        out = open(os.path.join(objdir(), "grade.out"), "w")
+        os.dup2(out.fileno(), 1)
+        os.dup2(out.fileno(), 2)
+        status = 0
+        try:
+            for test in group:
+                if selected(test):
+                    test()
+        except BaseException:
+            traceback.print_exc()
+            status = 1
+        sys.stdout.flush()
+        sys.stderr.flush()
+        with open(os.path.join(objdir(), "grade.result"), "w") as f:
+            f.write("%d %d %d %d %f\n" % (TOTAL, POSSIBLE, FAILED,
+                                           SNAPSHOT_BOOTS, SNAPSHOT_SECS))
+        os._exit(status)
+
+    def finish_worker(instance, status):
+        out = open(os.path.join(objdir(instance), "grade.out")).read()
+        path = os.path.join(objdir(instance), "grade.result")
+        try:
+            fields = open(path).read().split()
+            result = tuple(map(int, fields[:4])) + (float(fields[4]),)
+            os.unlink(path)
+        except EnvironmentError:
+            # The worker died before it could report; count a failure
+            out += "worker on instance %d died (status %d)\n" % \
+                (instance, status)
+            result = (0, 0, 1, 0, 0.0)
+        return out, result
+
+    def run_groups(groups):
+        global TOTAL, POSSIBLE, FAILED, SNAPSHOT_BOOTS, SNAPSHOT_SECS
+        groups = [g for g in groups if any(map(selected, g))]
+        free = list(range(jobs, 0, -1))
+        running = {}
+        results = {}
+        started = done = 0
+        while done < len(groups):
+            while free and started < len(groups):
+                instance = free.pop()
+                running[start_worker(groups[started], instance)] = \
+                    (started, instance)
+                started += 1
+            pid, status = os.waitpid(-1, 0)
+            if pid not in running:
+                continue
+            n, instance = running.pop(pid)
+            free.append(instance)
+            results[n] = finish_worker(instance, status)
+            while done in results:
+                out, (total, possible, failed, boots, secs) = \
+                    results.pop(done)
+                sys.stdout.write(out)
+                sys.stdout.flush()
+                TOTAL += total
+                POSSIBLE += possible
+                FAILED += failed
+                SNAPSHOT_BOOTS += boots
+                SNAPSHOT_SECS += secs
+                done += 1
+
+    groups = []
+    roots = {}
+    for test in TESTS:
+        if not hasattr(test, "parent"):
+            # end_part: finish everything before it first
+            run_groups(groups)
+            groups, roots = [], {}
+            if selected(test):
+                test()
+            continue
+        root = test
+        while root.parent:
+            root = root.parent
+        if root not in roots:
+            roots[root] = []
+            groups.append(roots[root])
+        roots[root].append(test)
+    run_groups(groups)
+
 def get_current_test():
     if not CURRENT_TEST:
         raise RuntimeError("No test is running")
@@ -191,7 +332,8 @@ def assert_lines_match(text, *regexps, **kw):
 # Utilities
 #
 
-__all__ += ["make", "maybe_unlink", "reset_fs", "color"]
+__all__ += ["make", "maybe_unlink", "maybe_rmtree", "reset_fs", "color",
+            "objdir"]
 
 MAKE_TIMESTAMP = 0
 
@@ -224,6 +366,25 @@ def maybe_unlink(*paths):
             if e.errno != errno.ENOENT:
                 raise
 
+def maybe_rmtree(path):
+    if os.path.exists(path):
+        shutil.rmtree(path)
+
+def objdir(instance=-1):
+    """The object directory for QEMU instance 'instance' (by default
+    the one this process runs on), or the shared one for None."""
+    if instance == -1:
+        instance = INSTANCE
+    return "obj" if instance is None else "obj.j%d" % instance
+
+def free_port():
+    """A TCP port nothing is listening on right now."""
+    s = socket.socket()
+    s.bind(("localhost", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
 COLORS = {"default": "\033[0m", "red": "\033[31m", "green": "\033[32m"}
 
 def color(name, text):
@@ -257,6 +418,11 @@ QEMU appears to already be running.  Please exit it if possible or use
 'killall qemu' or 'killall qemu.real'.""" % self.get_gdb_port(), file=sys.stderr)
             sys.exit(1)
 
+        if INSTANCE is not None:
+            # Run on this instance's snapshot, port and logs
+            make_args = ("OBJDIR=%s" % objdir(),
+                         "GDBPORT=%d" % self.get_gdb_port(),
+                         "QEMULOG=%s/qemu.log" % objdir()) + make_args
         if options.verbose:
             show_command(("make",) + make_args)
         cmd = ("make", "-s", "--no-print-directory") + make_args
@@ -288,13 +454,17 @@ QEMU appears to already be running.  Please exit it if possible or use
 
     def handle_read(self):
         buf = os.read(self.proc.stdout.fileno(), 4096)
+        self.feed(buf)
+        if buf == b"":
+            self.wait()
+            return
+
+    def feed(self, buf):
+        """Handle buf as output from QEMU."""
         self.outbytes.extend(buf)
         self.output = self.outbytes.decode("utf-8", "replace")
         for callback in self.on_output:
             callback(buf)
-        if buf == b"":
-            self.wait()
-            return
 
     def wait(self):
         if self.proc:
@@ -305,6 +475,11 @@ QEMU appears to already be running.  Please exit it if possible or use
         if self.proc:
             self.proc.terminate()
 
+    def write(self, text):
+        """Type text at QEMU's serial console."""
+        self.proc.stdin.write(text.encode("utf-8"))
+        self.proc.stdin.flush()
+
 class GDBClient(object):
     def __init__(self, port, timeout=15):
         start = time.time()
@@ -318,6 +493,8 @@ class GDBClient(object):
                 if time.time() >= start + timeout:
                     raise
         self.__buf = ""
+        # Whether the target has stopped (at a breakpoint)
+        self.stopped = False
 
     def fileno(self):
         if self.sock:
@@ -343,6 +520,7 @@ class GDBClient(object):
 
             if pkt.startswith("T05"):
                 # Breakpoint
+                self.stopped = True
                 raise TerminateTest
 
     def __send(self, cmd):
@@ -360,9 +538,60 @@ class GDBClient(object):
     def cont(self):
         self.__send("c")
 
+    def detach(self):
+        """Let the target run on without us."""
+        self.__send("D")
+
+    def interrupt(self, timeout=10):
+        """Stop the target, if it isn't stopped already."""
+        if self.stopped:
+            return
+        # A break stops a running target; the query gets an answer
+        # from a stopped one, such as one that stopped when we connected
+        self.__send_break()
+        self.__send("?")
+        deadline = time.time() + timeout
+        while not self.__recv(deadline).startswith(("T", "S")):
+            pass
+        self.stopped = True
+
+    def pmemsave(self, addr, size, path):
+        """Save 'size' bytes of the target's physical memory at 'addr'
+        to 'path', which is relative to QEMU's working directory."""
+        return self.monitor('pmemsave %d %d "%s"' % (addr, size, path))
+
+    def __recv(self, deadline):
+        """Return the next packet, waiting for it until deadline."""
+        while True:
+            m = re.search(r"\$([^#]*)#[0-9a-zA-Z]{2}", self.__buf)
+            if m:
+                self.__buf = self.__buf[m.end():]
+                return m.group(1)
+            self.sock.settimeout(max(deadline - time.time(), 0.1))
+            data = self.sock.recv(4096)
+            if not data:
+                raise socket.error("GDB connection closed")
+            self.__buf += data.decode("ascii", "replace")
+
     def breakpoint(self, addr):
         self.__send("Z1,%x,1" % addr)
 
+    def monitor(self, cmd, timeout=30):
+        """Run a QEMU monitor command while the target is stopped, and
+        return its output."""
+        self.__send("qRcmd," + binascii.hexlify(cmd.encode()).decode())
+        deadline = time.time() + timeout
+        out = ""
+        while True:
+            pkt = self.__recv(deadline)
+            if pkt == "OK":
+                return out
+            elif pkt.startswith("O"):
+                out += binascii.unhexlify(pkt[1:]).decode("utf-8", "replace")
+            elif not pkt.startswith(("T", "S")):
+                # (Stop replies can be left over from interrupt)
+                raise RuntimeError("monitor %r failed: %r" % (cmd, pkt))
+
 
 ##################################################################
 # QEMU test runner
@@ -389,11 +618,22 @@ class Runner():
         def run_qemu_kw(target_base="qemu", make_args=[], timeout=30):
             return target_base, make_args, timeout
         target_base, make_args, timeout = run_qemu_kw(**kw)
+        monitors = self.__default_monitors + monitors
+
+        # Start a plain boot of the kernel from its boot snapshot, or
+        # take one if the test stops where the snapshot would be
+        snap = None
+        if target_base == "qemu" and not make_args and options.snapshot:
+            snap = BootSnapshot(monitors)
+            make_args = snap.make_args()
 
         # Start QEMU
         pre_make()
+        start = time.time()
         self.qemu = QEMU(target_base + "-nox-gdb", *make_args)
         self.gdb = None
+        # Called with the Runner before QEMU is shut down
+        self.on_shutdown = []
 
         try:
             # Wait for QEMU to start or make to fail.  This will set
@@ -404,6 +644,10 @@ class Runner():
             if self.gdb is None:
                 print("Failed to connect to QEMU; output:")
                 print(self.qemu.output)
+                if snap and snap.restoring:
+                    # Perhaps QEMU can't load it; don't try it again
+                    snap.discard()
+                    print("(Discarded the boot snapshot.)")
                 sys.exit(1)
             post_make()
 
@@ -411,17 +655,35 @@ class Runner():
             self.reactors = [self.qemu, self.gdb]
 
             # Start monitoring
-            for m in self.__default_monitors + monitors:
+            for m in monitors:
                 m(self)
 
+            stopped = False
+            if snap and snap.restoring:
+                # Pick up where the snapshot left off
+                try:
+                    self.qemu.feed(snap.output())
+                except TerminateTest:
+                    stopped = True
+                stopped = stopped or snap.stops_at_point
+                snap.restored(time.time() - start)
+
             # Run and react
-            self.gdb.cont()
-            self.__react(self.reactors, timeout)
+            if not stopped:
+                mark = len(self.qemu.outbytes)
+                self.gdb.cont()
+                self.__react(self.reactors, timeout)
+                if snap and snap.saving and self.gdb.stopped:
+                    self.__drain()
+                    snap.save(self.gdb, self.qemu.outbytes[mark:],
+                              time.time() - start)
         finally:
             # Shutdown QEMU
             try:
                 if self.gdb is None:
                     sys.exit(1)
+                for f in self.on_shutdown:
+                    f(self)
                 self.qemu.kill()
                 self.__react(self.reactors, 5)
                 self.gdb.close()
@@ -443,6 +705,15 @@ Failed to shutdown QEMU.  You might need to 'killall qemu' or
         if not len(output):
             raise TerminateTest
 
+    def __drain(self):
+        """Read what QEMU has printed but we haven't seen yet."""
+        try:
+            while self.qemu.fileno() is not None and \
+                  select.select([self.qemu], [], [], 0.1)[0]:
+                self.qemu.handle_read()
+        except TerminateTest:
+            pass
+
     def __react(self, reactors, timeout):
         deadline = time.time() + timeout
         try:
@@ -468,7 +739,8 @@ Failed to shutdown QEMU.  You might need to 'killall qemu' or
         keyword arguments are as for run_qemu.  This runs on a disk
         snapshot unless the keyword argument 'snapshot' is False."""
 
-        maybe_unlink("obj/kern/init.o", "obj/kern/kernel")
+        maybe_unlink(os.path.join(objdir(), "kern/init.o"),
+                     os.path.join(objdir(), "kern/kernel"))
         if kw.pop("snapshot", True):
             kw.setdefault("make_args", []).append("QEMUEXTRA+=-snapshot")
         self.run_qemu(target_base="run-%s" % binary, *monitors, **kw)
@@ -479,47 +751,189 @@ Failed to shutdown QEMU.  You might need to 'killall qemu' or
 
         assert_lines_match(self.qemu.output, *args, **kwargs)
 
+##################################################################
+# Boot snapshots
+#
+
+# Tests of a plain boot all pass through the same state: the first call
+# to readline, at the monitor.  The first run that stops there saves the
+# machine, in a qcow2 overlay on kernel.img, along with the console
+# output up to that point.  Later runs of the same kernel.img on the
+# same QEMU load it with -loadvm instead of booting, and see the saved
+# output as if the kernel had just printed it.
+
+SNAPSHOT_POINT = "readline"
+QEMUIMG = os.environ.get("QEMUIMG", "qemu-img")
+
+# Boots skipped and seconds saved by skipping them.
+SNAPSHOT_BOOTS = 0
+SNAPSHOT_SECS = 0.0
+
+class BootSnapshot(object):
+    _QEMU_VERSION = None
+
+    def __init__(self, monitors):
+        kern = os.path.join(objdir(), "kern")
+        self.image = os.path.join(kern, "kernel.img")
+        self.disk = os.path.join(kern, "boot.qcow2")
+        self.outpath = os.path.join(kern, "boot.out")
+        self.metapath = os.path.join(kern, "boot.json")
+        self.stops_at_point = any(getattr(m, "breakpoint", None) ==
+                                  SNAPSHOT_POINT for m in monitors)
+
+        self.key = self.__key()
+        try:
+            self.meta = json.load(open(self.metapath))
+        except (EnvironmentError, ValueError):
+            self.meta = None
+        if self.meta and self.meta.get("key") != self.key:
+            # The kernel or QEMU changed since
+            self.discard()
+        self.restoring = self.meta is not None
+        self.saving = (not self.restoring and self.stops_at_point and
+                       self.__create())
+
+    def __key(self):
+        if BootSnapshot._QEMU_VERSION is None:
+            try:
+                qemu = Popen(["make", "-s", "--no-print-directory",
+                              "print-qemu"], stdout=subprocess.PIPE)
+                qemu = qemu.communicate()[0].decode().strip()
+                p = Popen([qemu, "--version"], stdout=subprocess.PIPE)
+                BootSnapshot._QEMU_VERSION = \
+                    p.communicate()[0].decode().splitlines()[0]
+            except (EnvironmentError, IndexError):
+                BootSnapshot._QEMU_VERSION = ""
+        h = hashlib.sha1(open(self.image, "rb").read())
+        return "%s %s" % (h.hexdigest(), BootSnapshot._QEMU_VERSION)
+
+    def __create(self):
+        self.discard()
+        try:
+            # The backing file's name is relative to the overlay's
+            p = Popen([QEMUIMG, "create", "-q", "-f", "qcow2", "-F", "raw",
+                       "-b", os.path.basename(self.image), self.disk],
+                      stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+            p.communicate()
+            return p.returncode == 0
+        except EnvironmentError:
+            return False
+
+    def make_args(self):
+        if not self.restoring and not self.saving:
+            return []
+        args = ["QEMUDISK=%s" % self.disk, "QEMUDISKFMT=qcow2"]
+        if self.restoring:
+            args.append("QEMUEXTRA+=-loadvm %s" % SNAPSHOT_POINT)
+        return args
+
+    def output(self):
+        return open(self.outpath, "rb").read()
+
+    def save(self, gdb, output, secs):
+        """Save the machine, which gdb has stopped at the snapshot
+        point after secs seconds of booting."""
+        try:
+            err = gdb.monitor("savevm %s" % SNAPSHOT_POINT)
+        except (RuntimeError, socket.error) as e:
+            err = str(e)
+        if err.strip():
+            print("\n    Boot snapshot failed: %s" % err.strip())
+            self.discard()
+            return
+        with open(self.outpath, "wb") as f:
+            f.write(output)
+        with open(self.metapath, "w") as f:
+            json.dump({"key": self.key, "boot_secs": secs}, f)
+
+    def restored(self, secs):
+        """Count a boot skipped by restoring in secs seconds."""
+        global SNAPSHOT_BOOTS, SNAPSHOT_SECS
+        SNAPSHOT_BOOTS += 1
+        SNAPSHOT_SECS += max(self.meta["boot_secs"] - secs, 0)
+
+    def discard(self):
+        maybe_unlink(self.metapath, self.outpath, self.disk)
+        self.meta = None
+
 ##################################################################
 # Monitors
 #
 
-__all__ += ["save", "stop_breakpoint", "call_on_line", "stop_on_line"]
+__all__ += ["save", "save_crash_dump", "stop_breakpoint", "call_on_line",
+            "stop_on_line", "monitor_commands",
+            "CRASHDUMP_PADDR", "CRASHDUMP_SIZE"]
 
 def save(path):
-    """Return a monitor that writes QEMU's output to path.  If the
-    test fails, copy the output to path.test-name."""
+    """Return a monitor that writes QEMU's output to path (to the
+    instance's object directory, in parallel mode).  If the test
+    fails, copy the output to path.test-name."""
 
     def setup_save(runner):
-        f.seek(0)
-        f.truncate()
-        runner.qemu.on_output.append(f.write)
+        if INSTANCE is not None:
+            log[0] = os.path.join(objdir(), os.path.basename(path))
+        f[0] = open(log[0], "wb")
+        runner.qemu.on_output.append(f[0].write)
         get_current_test().on_finish.append(save_on_finish)
 
     def save_on_finish(fail):
-        f.flush()
+        f[0].close()
         save_path = path + "." + get_current_test().__name__[5:]
         if fail:
-            shutil.copyfile(path, save_path)
+            shutil.copyfile(log[0], save_path)
             print("    QEMU output saved to %s" % save_path)
         elif os.path.exists(save_path):
             os.unlink(save_path)
             print("    (Old %s failure log removed)" % save_path)
 
-    f = open(path, "wb")
+    log = [path]
+    f = [None]
     return setup_save
 
+# Where the kernel writes its crash dump (see kern/crashdump.h)
+CRASHDUMP_PADDR = 0x80000
+CRASHDUMP_SIZE = 0x10000
+
+def save_crash_dump(path):
+    """Return a monitor that, if the kernel panics, saves its crash dump
+    to path (in the instance's object directory, in parallel mode) as
+    the test ends, for ./crash-dump."""
+
+    def setup_save_crash_dump(runner):
+        runner.on_shutdown.append(fetch)
+
+    def fetch(runner):
+        if "kernel panic at" not in runner.qemu.output or \
+           runner.gdb.fileno() is None:
+            return
+        dest = path
+        if INSTANCE is not None:
+            dest = os.path.join(objdir(), os.path.basename(path))
+        try:
+            runner.gdb.interrupt()
+            runner.gdb.pmemsave(CRASHDUMP_PADDR, CRASHDUMP_SIZE,
+                                os.path.abspath(dest))
+            print("    Crash dump saved to %s" % dest)
+        except (socket.error, RuntimeError) as e:
+            print("    Couldn't save the crash dump: %s" % e)
+
+    return setup_save_crash_dump
+
 def stop_breakpoint(addr):
     """Returns a monitor that stops when addr is reached.  addr may be
     a number or the name of a symbol."""
 
     def setup_breakpoint(runner):
         if isinstance(addr, str):
-            addrs = [int(sym[:8], 16) for sym in open("obj/kern/kernel.sym")
+            addrs = [int(sym[:8], 16) for sym in
+                     open(os.path.join(objdir(), "kern/kernel.sym"))
                      if sym[11:].strip() == addr]
             assert len(addrs), "Symbol %s not found" % addr
             runner.gdb.breakpoint(addrs[0])
         else:
             runner.gdb.breakpoint(addr)
+    # For BootSnapshot
+    setup_breakpoint.breakpoint = addr
     return setup_breakpoint
 
 def call_on_line(regexp, callback):
@@ -545,3 +959,38 @@ def stop_on_line(regexp):
     def stop(line):
         raise TerminateTest
     return call_on_line(regexp, stop)
+
+def monitor_commands(*cmds):
+    """Returns a monitor that types each of 'cmds' at a kernel monitor
+    prompt, in turn, and stops at the prompt after the last one."""
+
+    def setup_monitor_commands(runner):
+        state = {"pos": 0, "sent": 0}
+        def handle_output(output):
+            while True:
+                i = runner.qemu.output.find("K> ", state["pos"])
+                if i < 0:
+                    return
+                state["pos"] = i + 3
+                if state["sent"] == len(cmds):
+                    raise TerminateTest
+                runner.qemu.write(cmds[state["sent"]] + "\n")
+                state["sent"] += 1
+        runner.qemu.on_output.append(handle_output)
+    return setup_monitor_commands
+
+##################################################################
+# Kernel reports
+#
+
+__all__ += ["parse_boottime"]
+
+def parse_boottime(text):
+    """Parse the output of the kernel's 'boottime' command into a list
+    of (phase, microseconds since the first mark, microseconds in the
+    phase) tuples, in boot order."""
+
+    return [(m.group(1), int(m.group(2)), int(m.group(3)))
+            for m in re.finditer(
+                r"^boottime: (\S+) +at +(\d+) us \+ *(\d+) us",
+                text, re.MULTILINE)]
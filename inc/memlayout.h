@@ -92,6 +92,10 @@
 #define IOPHYSMEM	0x0A0000
 #define EXTPHYSMEM	0x100000
 
+// The boot loader saves the TSC it started at here, in the otherwise
+// unused low memory below its stack.  The kernel never allocates page 0.
+#define BOOT_TSC	0x500
+
 // Kernel stack.
 #define KSTACKTOP	KERNBASE
 #define KSTKSIZE	(8*PGSIZE)   		// size of a kernel stack
@@ -1,6 +1,7 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 
 #ifndef NULL
@@ -13,8 +14,17 @@ int	getchar(void);
 int	iscons(int fd);
 
 // lib/printfmt.c
+// A printer for vprintfmt_pr.  putstr may be NULL; if not, it is used
+// to emit runs of literal text, strings and digits in one call.
+struct printer {
+	void (*putch)(int ch, void *putdat);
+	void (*putstr)(const char *s, size_t len, void *putdat);
+	void *putdat;
+};
+
 void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list);
+void	vprintfmt_pr(const struct printer *pr, const char *fmt, va_list);
 int	snprintf(char *str, int size, const char *fmt, ...);
 int	vsnprintf(char *str, int size, const char *fmt, va_list);
 
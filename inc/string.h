@@ -19,6 +19,17 @@ void *	memcpy(void *dst, const void *src, size_t len);
 void *	memmove(void *dst, const void *src, size_t len);
 int	memcmp(const void *s1, const void *s2, size_t len);
 void *	memfind(const void *s, int c, size_t len);
+extern bool string_sse2;
+
+// Clobbers for asm that moves data through %xmm0-3 while string_sse2
+// is set.  GCC only accepts them when SSE is enabled, as it is for the
+// native x86-64 test builds; without it (the kernel), GCC never
+// allocates %xmm registers itself, so there is nothing to tell it.
+#ifdef __SSE__
+#define SSE2_CLOBBERS	, "xmm0", "xmm1", "xmm2", "xmm3"
+#else
+#define SSE2_CLOBBERS
+#endif
 
 long	strtol(const char *s, char **endptr, int base);
 
@@ -0,0 +1,195 @@
+// Frame-pointer stack unwinding.
+//
+// Every kernel function keeps the frame pointer, so each frame starts
+// with the caller's %ebp followed by the return address:
+//
+//	ebp + 8  ->  first argument
+//	ebp + 4  ->  return address
+//	ebp      ->  caller's ebp
+//
+// and entry.S clears %ebp before calling i386_init, which ends the
+// chain.  The walk still checks every frame against the bounds of the
+// stack it started on, so a corrupted frame stops it rather than
+// faulting.
+//
+// Samplers unwind the same few call sites over and over, so symbols go
+// through a small direct-mapped cache in front of debuginfo_eip.
+
+#include <inc/stdio.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/backtrace.h>
+#include <kern/kdebug.h>
+
+// Find the kernel stack containing 'addr'.  The boot stack is also
+// mapped just below KSTACKTOP, so accept either address for it.
+static bool
+stack_bounds(uintptr_t addr, uintptr_t *lo, uintptr_t *hi)
+{
+	extern char bootstack[], bootstacktop[];
+
+	if (addr >= (uintptr_t) bootstack && addr < (uintptr_t) bootstacktop) {
+		*lo = (uintptr_t) bootstack;
+		*hi = (uintptr_t) bootstacktop;
+		return 1;
+	}
+	if (addr >= KSTACKTOP - KSTKSIZE && addr < KSTACKTOP) {
+		*lo = KSTACKTOP - KSTKSIZE;
+		*hi = KSTACKTOP;
+		return 1;
+	}
+	return 0;
+}
+
+// Is 'ebp' a frame we can read, given the stack bounds?
+static bool
+frame_ok(uint32_t ebp, uintptr_t lo, uintptr_t hi)
+{
+	return ebp % 4 == 0 && ebp >= lo && ebp + 8 <= hi;
+}
+
+// The frame that called 'ebp', or 0 at the end of the chain.  Frames
+// only get older going up the stack, which also stops cycles.
+static uint32_t
+frame_next(uint32_t ebp, uintptr_t lo, uintptr_t hi)
+{
+	uint32_t next = ((uint32_t *) ebp)[0];
+
+	if (next <= ebp || !frame_ok(next, lo, hi))
+		return 0;
+	return next;
+}
+
+int
+backtrace_capture(uint32_t ebp, uintptr_t *eips, int max)
+{
+	uintptr_t lo, hi;
+	int n = 0;
+
+	if (!stack_bounds(ebp, &lo, &hi) || !frame_ok(ebp, lo, hi))
+		return 0;
+	for (; ebp && n < max; ebp = frame_next(ebp, lo, hi))
+		eips[n++] = ((uint32_t *) ebp)[1];
+	return n;
+}
+
+
+/***** Symbolization cache *****/
+
+struct SymCacheEntry {
+	uintptr_t eip;			// 0 if empty
+	int r;				// debuginfo_eip's result
+	struct Eipdebuginfo info;
+};
+
+static struct SymCacheEntry symcache[BACKTRACE_CACHE_SIZE];
+
+// Turn interrupts off and back on again around the cache.  The memory
+// clobbers keep the compiler from moving cache accesses out from
+// between them.
+static uint32_t
+irq_save(void)
+{
+	uint32_t eflags = read_eflags();
+
+	asm volatile("cli" : : : "memory");
+	return eflags;
+}
+
+static void
+irq_restore(uint32_t eflags)
+{
+	asm volatile("" : : : "memory");
+	write_eflags(eflags);
+}
+
+static struct SymCacheEntry *
+symcache_entry(uintptr_t eip)
+{
+	return &symcache[(eip ^ (eip >> 6)) % BACKTRACE_CACHE_SIZE];
+}
+
+// The cache is shared with interrupt handlers, so entries are only
+// read and written with interrupts off.  The lookup on a miss runs
+// with them back on, so a miss doesn't hold off interrupts.
+int
+backtrace_symbolize(uintptr_t eip, struct Eipdebuginfo *info)
+{
+	struct SymCacheEntry *e = symcache_entry(eip);
+	uint32_t eflags = irq_save();
+	int r;
+
+	if (e->eip == eip && eip) {
+		*info = e->info;
+		r = e->r;
+		irq_restore(eflags);
+		return r;
+	}
+	irq_restore(eflags);
+
+	r = debuginfo_eip(eip, info);
+
+	eflags = irq_save();
+	e->eip = eip;
+	e->r = r;
+	e->info = *info;
+	irq_restore(eflags);
+	return r;
+}
+
+void
+backtrace_cache_flush(void)
+{
+	uint32_t eflags = irq_save();
+	int i;
+
+	for (i = 0; i < BACKTRACE_CACHE_SIZE; i++)
+		symcache[i].eip = 0;
+	irq_restore(eflags);
+}
+
+
+void
+backtrace_print(uint32_t ebp)
+{
+	struct Eipdebuginfo info;
+	struct Eipinline inl[BACKTRACE_MAXINLINE];
+	uintptr_t lo, hi, eip;
+	uint32_t *args;
+	const char *file;
+	int depth, ninl, line, i;
+
+	cprintf("Stack backtrace:\n");
+	if (!stack_bounds(ebp, &lo, &hi) || !frame_ok(ebp, lo, hi)) {
+		cprintf("  ebp %08x is not on a kernel stack\n", ebp);
+		return;
+	}
+	for (depth = 0; ebp; ebp = frame_next(ebp, lo, hi), depth++) {
+		if (depth == BACKTRACE_MAXDEPTH) {
+			cprintf("  ...\n");
+			break;
+		}
+		// The outermost frame's arguments lie just above the top
+		// of the stack, which is still mapped kernel memory.
+		eip = ((uint32_t *) ebp)[1];
+		args = (uint32_t *) ebp + 2;
+		cprintf("  ebp %08x  eip %08x  args %08x %08x %08x %08x %08x\n",
+			ebp, eip, args[0], args[1], args[2], args[3], args[4]);
+		if (backtrace_symbolize(eip, &info) < 0)
+			continue;
+		// Each inlined call's location is in the next function out
+		file = info.eip_file;
+		line = info.eip_line;
+		ninl = debuginfo_inline(eip, inl, BACKTRACE_MAXINLINE);
+		for (i = 0; i < ninl; i++) {
+			cprintf("         %s:%d: %s (inlined)\n",
+				file, line, inl[i].inl_fn_name);
+			file = inl[i].inl_call_file;
+			line = inl[i].inl_call_line;
+		}
+		cprintf("         %s:%d: %.*s+%d\n", file, line,
+			info.eip_fn_namelen, info.eip_fn_name,
+			eip - info.eip_fn_addr);
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef JOS_KERN_BACKTRACE_H
+#define JOS_KERN_BACKTRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Eipdebuginfo;
+
+// Most frames backtrace_print will show.
+#define BACKTRACE_MAXDEPTH	32
+
+// Most inlined calls backtrace_print will show for a frame.
+#define BACKTRACE_MAXINLINE	8
+
+// Entries in the symbolization cache (a power of two).
+#define BACKTRACE_CACHE_SIZE	64
+
+// Walk the %ebp chain starting at frame 'ebp', storing up to 'max'
+// return addresses in 'eips', innermost first.  The walk stops at a
+// null %ebp or at a frame that leaves the kernel stack 'ebp' is on.
+// Returns the number of addresses stored.
+int backtrace_capture(uint32_t ebp, uintptr_t *eips, int max);
+
+// debuginfo_eip through a direct-mapped cache keyed by 'eip'.
+// Safe to call from interrupt handlers.
+int backtrace_symbolize(uintptr_t eip, struct Eipdebuginfo *info);
+
+// Forget everything in the symbolization cache.
+void backtrace_cache_flush(void);
+
+// Print the stack starting at frame 'ebp', in the monitor's format.
+// A frame's symbol line is preceded by one for each call inlined at
+// its return address, innermost first.
+void backtrace_print(uint32_t ebp);
+
+#endif	// !JOS_KERN_BACKTRACE_H
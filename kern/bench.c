@@ -0,0 +1,346 @@
+// Kernel microbenchmarks, run from the monitor with 'bench [name]'.
+//
+// Every benchmark reports its results as lines of the form
+//	bench <name>: key=value key=value ...
+// so that scripts driving the monitor can pick them out.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/bench.h>
+#include <kern/backtrace.h>
+#include <kern/console.h>
+#include <kern/kdebug.h>
+#include <kern/pmap.h>
+
+struct Bench {
+	const char *name;
+	const char *desc;
+	void (*func)(void);
+};
+
+static void bench_backtrace(void);
+static void bench_cga(void);
+static void bench_debuginfo(void);
+static void bench_fmt(void);
+static void bench_mem(void);
+static void bench_page(void);
+
+static struct Bench benches[] = {
+	{ "backtrace", "unwind and symbolize the stack, cold and cached", bench_backtrace },
+	{ "cga", "CGA output with and without the shadow buffer", bench_cga },
+	{ "debuginfo", "address to function/line lookups, table and stabs", bench_debuginfo },
+	{ "fmt", "%d, %u and %x through snprintf", bench_fmt },
+	{ "mem", "string and memory primitives, dword and SSE2", bench_mem },
+	{ "page", "cache pollution from zeroing and copying pages", bench_page },
+};
+
+// Convert a count of work done in 'cycles' TSC cycles to a rate.
+static uint32_t
+per_mcycle(uint64_t n, uint64_t cycles)
+{
+	if (cycles == 0)
+		return 0;
+	return n * 1000000 / cycles;
+}
+
+/***** Backtraces *****/
+
+#define BACKTRACE_BENCH_UNWINDS	2000
+
+// Unwind and symbolize this stack over and over, as a sampler would,
+// first flushing the symbol cache every time and then letting it warm.
+static void
+bench_backtrace(void)
+{
+	static const char *caches[] = { "cold", "warm" };
+	uintptr_t eips[BACKTRACE_MAXDEPTH];
+	struct Eipdebuginfo info;
+	uint64_t start, cycles;
+	int c, i, j, depth = 0;
+
+	for (c = 0; c < ARRAY_SIZE(caches); c++) {
+		backtrace_cache_flush();
+		start = read_tsc();
+		for (i = 0; i < BACKTRACE_BENCH_UNWINDS; i++) {
+			if (c == 0)
+				backtrace_cache_flush();
+			depth = backtrace_capture(read_ebp(), eips, ARRAY_SIZE(eips));
+			for (j = 0; j < depth; j++)
+				backtrace_symbolize(eips[j], &info);
+		}
+		cycles = read_tsc() - start;
+		cprintf("bench backtrace: cache=%s depth=%d unwinds=%d cycles/unwind=%llu\n",
+			caches[c], depth, BACKTRACE_BENCH_UNWINDS,
+			cycles / BACKTRACE_BENCH_UNWINDS);
+	}
+}
+
+/***** Console *****/
+
+#define CGA_BENCH_BYTES	(64 * 1024)
+
+// Scroll CGA_BENCH_BYTES of full lines through the display, drawing
+// straight into display memory and then through the shadow buffer.
+// Only the display is written, so the serial port doesn't dominate.
+static void
+bench_cga(void)
+{
+	static char line[CRT_COLS];
+	uint64_t start, cycles;
+	bool was;
+	int i, n, shadow;
+
+	for (i = 0; i < CRT_COLS - 1; i++)
+		line[i] = 'a' + i % 26;
+	line[CRT_COLS - 1] = '\n';
+
+	was = cga_shadow(0);
+	for (shadow = 0; shadow <= 1; shadow++) {
+		cga_shadow(shadow);
+		start = read_tsc();
+		for (n = 0; n < CGA_BENCH_BYTES; n += sizeof(line))
+			cga_write(line, sizeof(line));
+		cycles = read_tsc() - start;
+		cprintf("bench cga: shadow=%d bytes=%d cycles=%llu bytes/Mcycle=%u\n",
+			shadow, n, cycles, per_mcycle(n, cycles));
+	}
+	cga_shadow(was);
+}
+
+/***** Symbolization *****/
+
+#define DEBUGINFO_BENCH_ADDRS	4096
+
+// Look up addresses spread evenly over the kernel's text, first in the
+// prebuilt table and then by searching the stabs, and check that the
+// two agree on the function and line.
+static void
+bench_debuginfo(void)
+{
+	extern char entry[], etext[];
+	static const char *methods[] = { "table", "stabs" };
+	int (*lookup[])(uintptr_t, struct Eipdebuginfo *) = {
+		debuginfo_eip, debuginfo_eip_stabs
+	};
+	struct Eipdebuginfo a, b;
+	uintptr_t addr, step = (etext - entry) / DEBUGINFO_BENCH_ADDRS;
+	uint64_t start, cycles;
+	int m, i, found, mismatches = 0;
+
+	for (m = 0; m < ARRAY_SIZE(methods); m++) {
+		found = 0;
+		start = read_tsc();
+		for (i = 0; i < DEBUGINFO_BENCH_ADDRS; i++)
+			if (lookup[m]((uintptr_t) entry + i * step, &a) == 0)
+				found++;
+		cycles = read_tsc() - start;
+		cprintf("bench debuginfo: method=%s lookups=%d found=%d cycles/lookup=%llu\n",
+			methods[m], DEBUGINFO_BENCH_ADDRS, found,
+			cycles / DEBUGINFO_BENCH_ADDRS);
+	}
+
+	for (i = 0; i < DEBUGINFO_BENCH_ADDRS; i++) {
+		addr = (uintptr_t) entry + i * step;
+		if (debuginfo_eip(addr, &a) < 0 || debuginfo_eip_stabs(addr, &b) < 0)
+			continue;
+		if (a.eip_fn_addr != b.eip_fn_addr || a.eip_line != b.eip_line)
+			mismatches++;
+	}
+	cprintf("bench debuginfo: mismatches=%d\n", mismatches);
+}
+
+/***** Formatting *****/
+
+#define FMT_BENCH_CALLS	20000
+
+// Format a spread of values through snprintf, one conversion at a
+// time, so that the numbers mostly measure printnum.
+static void
+bench_fmt(void)
+{
+	static const char *fmts[] = { "%d", "%u", "%x", "%lld", "%llx" };
+	char buf[32];
+	uint64_t start, cycles;
+	unsigned long long v;
+	int f, i, bytes;
+
+	for (f = 0; f < ARRAY_SIZE(fmts); f++) {
+		bytes = 0;
+		start = read_tsc();
+		for (i = 0; i < FMT_BENCH_CALLS; i++) {
+			// Walk through numbers of every length
+			v = (unsigned) i * 2654435761U >> (i % 32);
+			if (fmts[f][1] == 'l')
+				bytes += snprintf(buf, sizeof(buf), fmts[f], v << (i % 32));
+			else
+				bytes += snprintf(buf, sizeof(buf), fmts[f], (unsigned) v);
+		}
+		cycles = read_tsc() - start;
+		cprintf("bench fmt: format=%s calls=%d bytes=%d cycles=%llu calls/Mcycle=%u\n",
+			fmts[f], FMT_BENCH_CALLS, bytes, cycles,
+			per_mcycle(FMT_BENCH_CALLS, cycles));
+	}
+}
+
+/***** Memory *****/
+
+#define MEM_BENCH_BYTES	(1024 * 1024)
+
+static char mem_src[16384 + 64] __attribute__((aligned(64)));
+static char mem_dst[16384 + 64] __attribute__((aligned(64)));
+
+enum { MEM_MEMCPY, MEM_MEMMOVE, MEM_MEMSET, MEM_MEMCMP, MEM_STRLEN };
+static const char *mem_ops[] = {
+	"memcpy", "memmove", "memset", "memcmp", "strlen"
+};
+
+// Run 'op' on 'size'-byte buffers, 'misalign' bytes off alignment,
+// until MEM_BENCH_BYTES have been processed.  memmove copies within
+// mem_dst so that it takes the backwards, overlapping path.
+static uint64_t
+mem_run(int op, size_t size, int misalign)
+{
+	char *src = mem_src + misalign, *dst = mem_dst;
+	uint64_t start;
+	int i, n = MEM_BENCH_BYTES / size;
+
+	memset(mem_src, 'x', sizeof(mem_src));
+	src[size - 1] = '\0';
+	memcpy(mem_dst, mem_src, sizeof(mem_dst));
+
+	start = read_tsc();
+	for (i = 0; i < n; i++)
+		switch (op) {
+		case MEM_MEMCPY:
+			memcpy(dst, src, size);
+			break;
+		case MEM_MEMMOVE:
+			memmove(dst + misalign + 1, dst, size);
+			break;
+		case MEM_MEMSET:
+			memset(dst + misalign, i, size);
+			break;
+		case MEM_MEMCMP:
+			memcmp(dst + misalign, src, size);
+			break;
+		case MEM_STRLEN:
+			strlen(src);
+			break;
+		}
+	return read_tsc() - start;
+}
+
+static void
+bench_mem(void)
+{
+	static const size_t sizes[] = { 64, 1024, 16384 };
+	bool had_sse2 = string_sse2;
+	uint64_t cycles;
+	int op, i, misalign, sse2;
+
+	for (op = 0; op < ARRAY_SIZE(mem_ops); op++)
+		for (i = 0; i < ARRAY_SIZE(sizes); i++)
+			for (misalign = 0; misalign <= 3; misalign += 3)
+				for (sse2 = 0; sse2 <= had_sse2; sse2++) {
+					string_sse2 = sse2;
+					cycles = mem_run(op, sizes[i], misalign);
+					cprintf("bench mem: op=%s size=%d misalign=%d sse2=%d bytes/Mcycle=%u\n",
+						mem_ops[op], sizes[i], misalign, sse2,
+						per_mcycle(MEM_BENCH_BYTES, cycles));
+				}
+	string_sse2 = had_sse2;
+}
+
+/***** Pages *****/
+
+#define PAGE_BENCH_WSET		(64 * 1024)
+#define PAGE_BENCH_PAGES	256
+
+static char page_wset[PAGE_BENCH_WSET] __attribute__((aligned(64)));
+static struct PageInfo *page_pages[PAGE_BENCH_PAGES];
+
+// Read one word from every cache line of the working set.
+static uint64_t
+wset_read(void)
+{
+	volatile uint32_t *p = (volatile uint32_t *) page_wset;
+	uint64_t start = read_tsc();
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < PAGE_BENCH_WSET / 4; i += 64 / 4)
+		sum += p[i];
+	return read_tsc() - start;
+}
+
+// Warm a working set small enough to stay cached, zero or copy a
+// megabyte of pages through the cache or around it, then time how long
+// the working set takes to read again.  The more the page operation
+// evicted, the closer 'after' gets to a cold read.
+static void
+bench_page(void)
+{
+	static const char *ops[] = { "zero", "copy" };
+	static const char *methods[] = { "cached", "streaming" };
+	struct PageInfo *src;
+	uint64_t warm, start, cycles, after;
+	int op, method, i, n;
+
+	if (!(src = page_alloc(ALLOC_ZERO))) {
+		cprintf("bench page: out of memory\n");
+		return;
+	}
+	for (n = 0; n < PAGE_BENCH_PAGES; n++)
+		if (!(page_pages[n] = page_alloc(0)))
+			break;
+
+	for (op = 0; op < ARRAY_SIZE(ops); op++)
+		for (method = 0; method < ARRAY_SIZE(methods); method++) {
+			wset_read();
+			warm = wset_read();
+			start = read_tsc();
+			for (i = 0; i < n; i++)
+				if (op == 0 && method == 0)
+					memset(page2kva(page_pages[i]), 0, PGSIZE);
+				else if (op == 0)
+					page_zero(page_pages[i]);
+				else if (method == 0)
+					memcpy(page2kva(page_pages[i]), page2kva(src), PGSIZE);
+				else
+					page_copy(page_pages[i], src);
+			cycles = read_tsc() - start;
+			after = wset_read();
+			cprintf("bench page: op=%s method=%s pages=%d cycles/page=%llu wset_warm=%llu wset_after=%llu\n",
+				ops[op], methods[method], n, n ? cycles / n : 0,
+				warm, after);
+		}
+
+	while (n > 0)
+		page_free(page_pages[--n]);
+	page_free(src);
+}
+
+
+int
+bench_run(const char *name)
+{
+	int i, found = 0;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		if (name == NULL || strcmp(name, benches[i].name) == 0) {
+			benches[i].func();
+			found = 1;
+		}
+	return found ? 0 : -1;
+}
+
+void
+bench_list(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++)
+		cprintf("  %-10s %s\n", benches[i].name, benches[i].desc);
+}
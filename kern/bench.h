@@ -0,0 +1,14 @@
+#ifndef JOS_KERN_BENCH_H
+#define JOS_KERN_BENCH_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+// Run the benchmark called 'name', or every benchmark if 'name' is NULL.
+// Returns -1 if there is no such benchmark.
+int bench_run(const char *name);
+
+// List the available benchmarks.
+void bench_list(void);
+
+#endif	// !JOS_KERN_BENCH_H
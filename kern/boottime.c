@@ -0,0 +1,63 @@
+// Boot timeline.
+//
+// Each phase of boot ends with a boottime_mark, which just saves the
+// TSC.  The first marks come from before the kernel could keep them:
+// the boot loader leaves its starting TSC at BOOT_TSC, and entry.S
+// saves the kernel's in boottime_entry.
+
+#include <inc/stdio.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/boottime.h>
+#include <kern/kclock.h>
+
+extern uint64_t boottime_entry;		// set by entry.S
+
+static struct {
+	uint64_t tsc;
+	const char *phase;
+} marks[BOOTTIME_NMARKS];
+static int nmarks;
+
+static void
+boottime_mark_at(uint64_t tsc, const char *phase)
+{
+	if (nmarks == BOOTTIME_NMARKS)
+		return;
+	marks[nmarks].tsc = tsc;
+	marks[nmarks++].phase = phase;
+}
+
+void
+boottime_init(uint64_t i386_init_tsc)
+{
+	// Page 0 is still mapped by entry_pgdir.  The loader's TSC is
+	// only believable if it came before ours, since a loader that
+	// doesn't leave one leaves whatever the BIOS did.
+	uint64_t loader = *(volatile uint64_t *) (KERNBASE + BOOT_TSC);
+
+	if (loader && loader < boottime_entry)
+		boottime_mark_at(loader, "loader");
+	boottime_mark_at(boottime_entry, "entry");
+	boottime_mark_at(i386_init_tsc, "i386_init");
+}
+
+void
+boottime_mark(const char *phase)
+{
+	boottime_mark_at(read_tsc(), phase);
+}
+
+void
+boottime_print(void)
+{
+	int i;
+
+	for (i = 0; i < nmarks; i++)
+		cprintf("boottime: %-28s at %8llu us +%8llu us\n",
+			marks[i].phase,
+			cycles_to_ns(marks[i].tsc - marks[0].tsc) / 1000,
+			i ? cycles_to_ns(marks[i].tsc - marks[i - 1].tsc) / 1000
+			  : 0);
+}
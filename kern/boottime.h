@@ -0,0 +1,24 @@
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Most phases boottime_mark records.
+#define BOOTTIME_NMARKS	32
+
+// Start the timeline.  'i386_init_tsc' is the TSC at the top of
+// i386_init, read before the BSS (where the timeline lives) was cleared.
+void boottime_init(uint64_t i386_init_tsc);
+
+// Note that boot phase 'phase' (a string constant without spaces) has
+// just finished.
+void boottime_mark(const char *phase);
+
+// Print the timeline, one phase per line:
+//	boottime: <phase> at <us since the first mark> us +<us in phase> us
+void boottime_print(void);
+
+#endif	// !JOS_KERN_BOOTTIME_H
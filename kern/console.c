@@ -5,8 +5,11 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/trap.h>
 
 #include <kern/console.h>
+#include <kern/picirq.h>
+#include <kern/trace.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
@@ -33,6 +36,10 @@ delay(void)
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE	0x01	//   Enable FIFOs
+#define   COM_FCR_CLEAR	0x06	//   Clear receive and transmit FIFOs
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled (reads back from IIR)
+#define   COM_FIFO_SIZE	16	//   Transmit FIFO depth of a 16550A
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -46,6 +53,7 @@ delay(void)
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
 static bool serial_exists;
+static int serial_burst;	// bytes we may send per TXRDY
 
 static int
 serial_proc_data(void)
@@ -75,11 +83,29 @@ serial_putc(int c)
 	outb(COM1 + COM_TX, c);
 }
 
+static void
+serial_write(const char *buf, size_t n)
+{
+	int i, burst;
+
+	while (n > 0) {
+		for (i = 0;
+		     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
+		     i++)
+			delay();
+
+		// TXRDY means the whole transmit FIFO is empty,
+		// so we can fill it without polling in between.
+		for (burst = serial_burst; burst > 0 && n > 0; burst--, n--)
+			outb(COM1 + COM_TX, *buf++);
+	}
+}
+
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on the FIFOs, with a receive trigger level of one byte
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_CLEAR);
 
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
@@ -89,17 +115,66 @@ serial_init(void)
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
-	// No modem controls
-	outb(COM1+COM_MCR, 0);
+	// No modem controls, but OUT2 gates the UART's interrupt line
+	outb(COM1+COM_MCR, COM_MCR_OUT2);
 	// Enable rcv interrupts
 	outb(COM1+COM_IER, COM_IER_RDI);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	// Only a 16550A has working FIFOs
+	serial_burst = ((inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO
+			? COM_FIFO_SIZE : 1);
 	(void) inb(COM1+COM_RX);
 
+	// Enable serial interrupts
+	if (serial_exists)
+		irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_SERIAL));
+}
+
+// The second serial port carries binary kernel trace records (see
+// kern/trace.c), never console text.  It is output only, runs as fast
+// as the UART goes, and never interrupts.
+
+#define COM2		0x2F8
+
+static bool com2_exists;
+static int com2_burst;
+
+bool
+com2_init(void)
+{
+	outb(COM2+COM_FCR, COM_FCR_ENABLE | COM_FCR_CLEAR);
+	outb(COM2+COM_LCR, COM_LCR_DLAB);
+	outb(COM2+COM_DLL, 1);		// 115200 baud
+	outb(COM2+COM_DLM, 0);
+	outb(COM2+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
+	outb(COM2+COM_MCR, 0);
+	outb(COM2+COM_IER, 0);
+
+	com2_exists = (inb(COM2+COM_LSR) != 0xFF);
+	com2_burst = ((inb(COM2+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO
+		      ? COM_FIFO_SIZE : 1);
+	return com2_exists;
+}
+
+void
+com2_write(const void *buf, size_t n)
+{
+	const uint8_t *p = buf;
+	int i, burst;
+
+	if (!com2_exists)
+		return;
+	while (n > 0) {
+		for (i = 0;
+		     !(inb(COM2 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
+		     i++)
+			delay();
+		for (burst = com2_burst; burst > 0 && n > 0; burst--, n--)
+			outb(COM2 + COM_TX, *p++);
+	}
 }
 
 
@@ -120,14 +195,53 @@ lpt_putc(int c)
 	outb(0x378+2, 0x08);
 }
 
+static void
+lpt_write(const char *buf, size_t n)
+{
+	while (n-- > 0)
+		lpt_putc((unsigned char) *buf++);
+}
+
 
 
 
 /***** Text-mode CGA/VGA display output *****/
 
+// The visible screen is a CRT_SIZE window that starts crt_origin cells
+// into display memory.  Scrolling moves the window down a line by
+// reprogramming the 6845 start address; only when the window reaches the
+// end of display memory do we copy the screen back to the top.
+//
+// Display memory is slow to touch, so by default characters are drawn
+// into crt_shadow, a copy of display memory in normal RAM, and the range
+// of cells changed since the last flush is copied out at the end of
+// each line or on cons_flush().  cga_shadow(0) draws straight into
+// display memory instead, for comparison.
+
 static unsigned addr_6845;
-static uint16_t *crt_buf;
-static uint16_t crt_pos;
+static uint16_t *crt_buf;	// display memory
+static uint16_t *crt_cells;	// where we draw: crt_buf or crt_shadow
+static uint16_t crt_pos;	// cursor position within the visible screen
+static uint16_t crt_origin;	// first visible cell in crt_buf
+static uint16_t crt_bufsize;	// cells of display memory we may scroll over
+static uint16_t crt_cursor;	// cursor position last written to the 6845
+static uint16_t crt_hw_origin;	// start address last written to the 6845
+
+static uint16_t crt_shadow[CGA_BUFSIZE];
+static uint16_t crt_dirty_lo;	// crt_shadow[lo, hi) is newer than crt_buf
+static uint16_t crt_dirty_hi;
+
+static void cga_flush(void);
+
+static void
+cga_set_origin(void)
+{
+	outb(addr_6845, 12);
+	outb(addr_6845 + 1, crt_origin >> 8);
+	outb(addr_6845, 13);
+	outb(addr_6845 + 1, crt_origin);
+	crt_hw_origin = crt_origin;
+}
 
 static void
 cga_init(void)
@@ -142,9 +256,12 @@ cga_init(void)
 	if (*cp != 0xA55A) {
 		cp = (uint16_t*) (KERNBASE + MONO_BUF);
 		addr_6845 = MONO_BASE;
+		// An MDA only has one screen's worth of memory.
+		crt_bufsize = CRT_SIZE;
 	} else {
 		*cp = was;
 		addr_6845 = CGA_BASE;
+		crt_bufsize = CGA_BUFSIZE;
 	}
 
 	/* Extract cursor location */
@@ -155,13 +272,63 @@ cga_init(void)
 
 	crt_buf = (uint16_t*) cp;
 	crt_pos = pos;
+	crt_cursor = pos;
+
+	// The BIOS leaves the screen at the start of display memory,
+	// but make sure the 6845 agrees with us.
+	crt_origin = 0;
+	cga_set_origin();
+
+	crt_cells = crt_buf;
+	cga_shadow(1);
 }
 
+// Note that crt_cells[i, j) changed.
+static inline void
+cga_touch(uint16_t i, uint16_t j)
+{
+	if (crt_cells != crt_shadow)
+		return;
+	if (crt_dirty_lo >= crt_dirty_hi) {
+		crt_dirty_lo = i;
+		crt_dirty_hi = j;
+		return;
+	}
+	if (i < crt_dirty_lo)
+		crt_dirty_lo = i;
+	if (j > crt_dirty_hi)
+		crt_dirty_hi = j;
+}
+
+// Scroll the visible screen up by one line.
+static void
+cga_scroll(void)
+{
+	int i;
 
+	if (crt_origin + CRT_SIZE + CRT_COLS <= crt_bufsize)
+		crt_origin += CRT_COLS;
+	else {
+		// Out of display memory: move the screen (minus its top
+		// line) back to the start and scroll from there again.
+		memmove(crt_cells, crt_cells + crt_origin + CRT_COLS,
+			(CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
+		crt_origin = 0;
+		// Whatever was still dirty up there is now off screen.
+		crt_dirty_lo = crt_dirty_hi = 0;
+		cga_touch(0, CRT_SIZE - CRT_COLS);
+	}
+	for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
+		crt_cells[crt_origin + i] = 0x0700 | ' ';
+	cga_touch(crt_origin + CRT_SIZE - CRT_COLS, crt_origin + CRT_SIZE);
+	crt_pos -= CRT_COLS;
+}
 
 static void
 cga_putc(int c)
 {
+	uint16_t i;
+
 	// if no attribute given, then use black on white
 	if (!(c & ~0xFF))
 		c |= 0x0700;
@@ -169,8 +336,9 @@ cga_putc(int c)
 	switch (c & 0xff) {
 	case '\b':
 		if (crt_pos > 0) {
-			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			i = crt_origin + --crt_pos;
+			crt_cells[i] = (c & ~0xff) | ' ';
+			cga_touch(i, i + 1);
 		}
 		break;
 	case '\n':
@@ -180,32 +348,77 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
+		cga_putc(' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		i = crt_origin + crt_pos++;
+		crt_cells[i] = c;		/* write the character */
+		cga_touch(i, i + 1);
 		break;
 	}
 
-	// What is the purpose of this?
-	if (crt_pos >= CRT_SIZE) {
-		int i;
+	if (crt_pos >= CRT_SIZE)
+		cga_scroll();
+	if ((c & 0xff) == '\n')
+		cga_flush();
+}
+
+// Bring display memory and the 6845 up to date with what we have drawn.
+// The start address and the cursor each cost four slow port writes,
+// so they are only written here, and only if they changed.
+static void
+cga_flush(void)
+{
+	uint16_t pos;
 
-		memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
-		crt_pos -= CRT_COLS;
+	if (crt_dirty_lo < crt_dirty_hi) {
+		memmove(crt_buf + crt_dirty_lo, crt_shadow + crt_dirty_lo,
+			(crt_dirty_hi - crt_dirty_lo) * sizeof(uint16_t));
+		crt_dirty_lo = crt_dirty_hi = 0;
 	}
 
+	if (crt_origin != crt_hw_origin)
+		cga_set_origin();
+
 	/* move that little blinky thing */
+	pos = crt_origin + crt_pos;
+	if (pos == crt_cursor)
+		return;
 	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
+	outb(addr_6845 + 1, pos >> 8);
 	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+	outb(addr_6845 + 1, pos);
+	crt_cursor = pos;
+}
+
+// Draw into the RAM shadow if 'enable', else straight into display
+// memory.  Returns the previous setting.
+bool
+cga_shadow(bool enable)
+{
+	bool was = (crt_cells == crt_shadow);
+
+	cga_flush();
+	if (enable && !was)
+		// Only the visible screen matters; everything else gets
+		// cleared as it scrolls into view.
+		memmove(crt_shadow + crt_origin, crt_buf + crt_origin,
+			CRT_SIZE * sizeof(uint16_t));
+	crt_cells = enable ? crt_shadow : crt_buf;
+	return was;
+}
+
+// Write a run of characters to the display alone.
+void
+cga_write(const char *buf, size_t n)
+{
+	while (n-- > 0)
+		cga_putc((unsigned char) *buf++);
+	cga_flush();
 }
 
 
@@ -373,6 +586,9 @@ kbd_intr(void)
 static void
 kbd_init(void)
 {
+	// Drain the kbd buffer so that QEMU generates interrupts.
+	kbd_intr();
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_KBD));
 }
 
 
@@ -381,51 +597,184 @@ kbd_init(void)
 // Here we manage the console input buffer,
 // where we stash characters received from the keyboard or serial port
 // whenever the corresponding interrupt occurs.
-
-#define CONSBUFSIZE 512
+//
+// The buffer is a single-producer, single-consumer ring.  Only cons_intr
+// advances wpos (always with interrupts disabled, from an IRQ handler or
+// from a poll), and only cons_read advances rpos, so neither side needs
+// a lock.  Both positions run freely and are reduced mod CONSBUFSIZE on
+// use, so wpos - rpos is the number of unread bytes.  Input that arrives
+// while the ring is full is dropped and counted rather than overwriting
+// what hasn't been read yet.
+
+// Each side must finish with a slot before publishing its new position.
+// x86 doesn't reorder stores with other stores or loads with other
+// loads, so keeping the compiler in order is all that's needed.
+#define cons_barrier()	asm volatile("" : : : "memory")
 
 static struct {
 	uint8_t buf[CONSBUFSIZE];
-	uint32_t rpos;
-	uint32_t wpos;
+	volatile uint32_t rpos;
+	volatile uint32_t wpos;
+	uint32_t drops;		// bytes lost to a full buffer
 } cons;
 
+// Input replay.  A kernel built with 'make CONS_REPLAY=file' has the
+// console input recorded in 'file' compiled in (see kern/Makefrag), and
+// takes its input from that, ignoring the keyboard and serial port,
+// until it runs out.  Each line is handed over only once the console
+// has been read dry, however long it took to type, so every replay
+// feeds the same bytes at the same points in the kernel's execution.
+#ifdef CONS_REPLAY
+extern const uint8_t cons_replay_start[], cons_replay_end[];
+#else
+static const uint8_t cons_replay_start[1];
+#define cons_replay_end	cons_replay_start
+#endif
+
+static struct {
+	const uint8_t *pos;
+	bool eol;		// handed over a whole line this time
+} replay = { cons_replay_start };
+
+static bool
+replay_pending(void)
+{
+	return replay.pos < cons_replay_end;
+}
+
+static int
+replay_proc_data(void)
+{
+	int c;
+
+	if (replay.eol || !replay_pending())
+		return -1;
+	c = *replay.pos++;
+	replay.eol = c == '\n' || c == '\r';
+	return c;
+}
+
+static void
+replay_intr(void)
+{
+	if (!replay_pending() || cons.rpos != cons.wpos)
+		return;
+	replay.eol = 0;
+	cons_intr(replay_proc_data);
+}
+
 // called by device interrupt routines to feed input characters
 // into the circular console input buffer.
 static void
 cons_intr(int (*proc)(void))
 {
+	uint32_t wpos = cons.wpos;
+	bool discard = replay_pending() && proc != replay_proc_data;
 	int c;
 
+	static_assert((CONSBUFSIZE & (CONSBUFSIZE - 1)) == 0);
+
 	while ((c = (*proc)()) != -1) {
-		if (c == 0)
+		if (c == 0 || discard)
+			continue;
+		if (wpos - cons.rpos == CONSBUFSIZE) {
+			cons.drops++;
 			continue;
-		cons.buf[cons.wpos++] = c;
-		if (cons.wpos == CONSBUFSIZE)
-			cons.wpos = 0;
+		}
+		cons.buf[wpos++ % CONSBUFSIZE] = c;
+		cons_barrier();
+		cons.wpos = wpos;
+		// The input record trace-decode --input saves for replay
+		trace(CONS_TRACE_INPUT, c);
 	}
 }
 
+// Poll the input devices for anything their interrupts haven't
+// delivered, so that input works even when interrupts are disabled
+// (e.g., when called from the kernel monitor).
+static void
+cons_poll(void)
+{
+	uint32_t eflags;
+
+	// Keep the device interrupts out while we poll the same devices.
+	eflags = read_eflags();
+	asm volatile("cli");
+	serial_intr();
+	kbd_intr();
+	replay_intr();
+	write_eflags(eflags);
+}
+
+// Move up to n bytes of pending console input into buf.
+// Returns the number of bytes read, which is 0 if none are waiting.
+size_t
+cons_read(void *buf, size_t n)
+{
+	uint32_t rpos = cons.rpos;
+	size_t avail, first;
+
+	cons_poll();
+
+	avail = cons.wpos - rpos;
+	cons_barrier();
+	if (n > avail)
+		n = avail;
+
+	// Copy out in at most two pieces, either side of the wrap.
+	first = CONSBUFSIZE - rpos % CONSBUFSIZE;
+	if (first > n)
+		first = n;
+	memmove(buf, &cons.buf[rpos % CONSBUFSIZE], first);
+	memmove((char *) buf + first, cons.buf, n - first);
+
+	cons_barrier();
+	cons.rpos = rpos + n;
+	return n;
+}
+
 // return the next input character from the console, or 0 if none waiting
 int
 cons_getc(void)
 {
-	int c;
+	uint8_t c;
 
-	// poll for any pending input characters,
-	// so that this function works even when interrupts are disabled
-	// (e.g., when called from the kernel monitor).
-	serial_intr();
-	kbd_intr();
+	if (cons_read(&c, 1) == 0)
+		return 0;
+	return c;
+}
 
-	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
-	}
-	return 0;
+// Number of input bytes dropped because the buffer was full.
+uint32_t
+cons_drops(void)
+{
+	return cons.drops;
+}
+
+// Wait for the keyboard or serial port to interrupt us.
+static void
+cons_sleep(void)
+{
+	uint32_t eflags;
+
+	// Until interrupts are wired up, all we can do is keep polling.
+	if (!pic_inited)
+		return;
+
+	// Idle time is a good time to ship trace records off the machine,
+	// a few at a time so that input isn't kept waiting.  Until they
+	// are all out, poll again rather than sleep.
+	if (trace_sink_drain(TRACE_SINK_BATCH) > 0)
+		return;
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	// sti takes effect after the next instruction, so an interrupt
+	// that arrives once we have checked the buffer still wakes the hlt.
+	// Replayed input comes from polling, not interrupts.
+	if (cons.rpos == cons.wpos && !replay_pending())
+		asm volatile("sti; hlt");
+	write_eflags(eflags);
 }
 
 // output a character to the console
@@ -437,6 +786,22 @@ cons_putc(int c)
 	cga_putc(c);
 }
 
+// output a run of characters to the console, one pass per device
+void
+cons_write(const char *buf, size_t n)
+{
+	serial_write(buf, n);
+	lpt_write(buf, n);
+	cga_write(buf, n);
+}
+
+// push any deferred output state out to the devices
+void
+cons_flush(void)
+{
+	cga_flush();
+}
+
 // initialize the console devices
 void
 cons_init(void)
@@ -458,14 +823,27 @@ cputchar(int c)
 	cons_putc(c);
 }
 
+// getchar takes input from the ring a run at a time, so that a line
+// arriving at once (pasted, or replayed) costs one poll, not one per
+// byte.  Bytes staged here have already left the ring, so anything
+// else reading it (cons_getc) would see them out of order.
+static struct {
+	uint8_t buf[64];
+	uint32_t pos, len;
+} getc_buf;
+
 int
 getchar(void)
 {
-	int c;
-
-	while ((c = cons_getc()) == 0)
-		/* do nothing */;
-	return c;
+	// Whatever we echoed last should be visible while we wait.
+	cons_flush();
+	while (getc_buf.pos == getc_buf.len) {
+		getc_buf.pos = 0;
+		getc_buf.len = cons_read(getc_buf.buf, sizeof(getc_buf.buf));
+		if (getc_buf.len == 0)
+			cons_sleep();
+	}
+	return getc_buf.buf[getc_buf.pos++];
 }
 
 int
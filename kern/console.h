@@ -16,9 +16,30 @@
 #define CRT_ROWS	25
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
+#define CGA_BUFSIZE	0x4000	// cells of color text memory (32KB)
+
+// Size of the console input buffer, which must be a power of two.
+// Override with e.g. 'make DEFS=-DCONSBUFSIZE=4096'.
+#ifndef CONSBUFSIZE
+#define CONSBUFSIZE	512
+#endif
+
+// Format of the trace record of each byte of console input.
+// trace-decode --input collects them into a recording for CONS_REPLAY.
+#define CONS_TRACE_INPUT	"cons: input %02x"
 
 void cons_init(void);
 int cons_getc(void);
+size_t cons_read(void *buf, size_t n);
+uint32_t cons_drops(void);
+void cons_write(const char *buf, size_t n);
+void cons_flush(void);
+
+bool cga_shadow(bool enable);
+void cga_write(const char *buf, size_t n);
+
+bool com2_init(void);
+void com2_write(const void *buf, size_t n);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
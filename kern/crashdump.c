@@ -0,0 +1,93 @@
+// Crash dumps.
+//
+// The dump goes to a fixed physical address, mapped at the same place
+// by entry_pgdir and kern_pgdir, so it can be written at any point in
+// the boot.  Everything in it is copied out of the kernel's own data
+// structures, which may be what's broken, so nothing is followed
+// without a bounds check first.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+
+#include <kern/crashdump.h>
+#include <kern/backtrace.h>
+#include <kern/kclock.h>
+
+#define crashdump	((struct CrashDump *) (KERNBASE + CRASHDUMP_PADDR))
+
+void
+crashdump_init(void)
+{
+	static_assert(sizeof(struct CrashDump) <= CRASHDUMP_SIZE);
+
+	crashdump->cd_magic = 0;
+}
+
+// Summarize kern_pgdir: its entries, and how much of each of its page
+// tables is in use.
+static void
+crashdump_pgdir(struct CrashDump *cd)
+{
+	const pte_t *pt;
+	physaddr_t pa;
+	int i, j;
+
+	if (!kern_pgdir || (uintptr_t) kern_pgdir < KERNBASE)
+		return;
+	cd->cd_pgdir = (uintptr_t) kern_pgdir - KERNBASE;
+	for (i = 0; i < NPDENTRIES; i++) {
+		cd->cd_pdes[i] = kern_pgdir[i];
+		pa = PTE_ADDR(kern_pgdir[i]);
+		if (!(kern_pgdir[i] & PTE_P) || (kern_pgdir[i] & PTE_PS)
+		    || PGNUM(pa) >= npages)
+			continue;
+		pt = (const pte_t *) (KERNBASE + pa);
+		for (j = 0; j < NPTENTRIES; j++)
+			cd->cd_nptes[i] += pt[j] & PTE_P;
+	}
+}
+
+void
+crashdump_write(const char *file, int line, uintptr_t eip,
+		const struct PushRegs *regs, const char *fmt, va_list ap)
+{
+	struct CrashDump *cd = crashdump;
+	struct CrashRegs *cr = &cd->cd_regs;
+
+	memset(cd, 0, sizeof(*cd));
+	cd->cd_size = sizeof(*cd);
+	cd->cd_tsc = read_tsc();
+	cd->cd_tsc_khz = ktime_calib.tsc_khz;
+	cd->cd_file = (uintptr_t) file;
+	cd->cd_line = line;
+	cd->cd_eip = eip;
+	vsnprintf(cd->cd_msg, sizeof(cd->cd_msg), fmt, ap);
+
+	cr->cr_regs = *regs;
+	cr->cr_eflags = read_eflags();
+	cr->cr_cr0 = rcr0();
+	cr->cr_cr2 = rcr2();
+	cr->cr_cr3 = rcr3();
+	cr->cr_cr4 = rcr4();
+	asm volatile("movw %%cs, %0" : "=m" (cr->cr_cs));
+	asm volatile("movw %%ds, %0" : "=m" (cr->cr_ds));
+	asm volatile("movw %%es, %0" : "=m" (cr->cr_es));
+	asm volatile("movw %%ss, %0" : "=m" (cr->cr_ss));
+
+	cd->cd_ndepth = backtrace_capture(regs->reg_ebp, cd->cd_eips,
+					  CRASHDUMP_MAXDEPTH);
+
+	cd->cd_npages = npages;
+	if (pages)
+		page_free_stats(&cd->cd_free);
+	crashdump_pgdir(cd);
+
+	cd->cd_ntrace = trace_copy(cd->cd_trace, TRACE_NRECORDS,
+				   &cd->cd_trace_seq);
+
+	// Complete
+	asm volatile("" : : : "memory");
+	cd->cd_magic = CRASHDUMP_MAGIC;
+}
@@ -0,0 +1,93 @@
+#ifndef JOS_KERN_CRASHDUMP_H
+#define JOS_KERN_CRASHDUMP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/stdarg.h>
+#include <inc/mmu.h>
+#include <inc/trap.h>
+
+#include <kern/pmap.h>
+#include <kern/trace.h>
+
+// _panic writes a dump of the machine into physical memory that
+// page_init never hands out, where it outlasts whatever the kernel does
+// next.  The host pulls it out of a running QEMU with pmemsave (see
+// ./crash-dump), which also decodes it; keep the layout in step with
+// the one there.  A dump is only complete once cd_magic is set, which
+// is written last.
+#define CRASHDUMP_PADDR		0x80000		// in base memory
+#define CRASHDUMP_SIZE		0x10000
+#define CRASHDUMP_MAGIC		0x504d4443	// "CDMP"
+
+#define CRASHDUMP_MSGLEN	256
+#define CRASHDUMP_MAXDEPTH	32
+
+struct CrashRegs {
+	struct PushRegs cr_regs;	// as _panic found them; reg_oesp
+					// is %esp
+	uint32_t cr_eflags;
+	uint32_t cr_cr0;
+	uint32_t cr_cr2;
+	uint32_t cr_cr3;
+	uint32_t cr_cr4;
+	uint16_t cr_cs;
+	uint16_t cr_ds;
+	uint16_t cr_es;
+	uint16_t cr_ss;
+} __attribute__((packed));
+
+// All fields are little-endian, and none need padding.
+struct CrashDump {
+	uint32_t cd_magic;		// CRASHDUMP_MAGIC once complete
+	uint32_t cd_size;		// sizeof(struct CrashDump)
+	uint64_t cd_tsc;		// read_tsc() at the panic
+	uint32_t cd_tsc_khz;		// TSC rate (0 if unknown)
+	uint32_t cd_file;		// kernel address of the file name
+	uint32_t cd_line;
+	uint32_t cd_eip;		// where _panic was called from
+	char cd_msg[CRASHDUMP_MSGLEN];	// the formatted message
+
+	struct CrashRegs cd_regs;
+
+	uint32_t cd_ndepth;		// backtrace, innermost first
+	uint32_t cd_eips[CRASHDUMP_MAXDEPTH];
+
+	uint32_t cd_npages;
+	struct PageFreeStats cd_free;
+
+	// kern_pgdir (0 before mem_init made it), its entries, and the
+	// number of present entries in each of its page tables
+	uint32_t cd_pgdir;
+	uint32_t cd_pdes[NPDENTRIES];
+	uint16_t cd_nptes[NPDENTRIES];
+
+	uint32_t cd_trace_seq;		// sequence number of cd_trace[0]
+	uint32_t cd_ntrace;		// the trace ring, oldest first
+	struct TraceRecord cd_trace[TRACE_NRECORDS];
+};
+
+// Save the general registers in 'r', a struct PushRegs, as close as
+// possible to the way the caller found them.  A macro, so there is no
+// call in between.
+#define crashdump_save_regs(r)						\
+	asm volatile("movl %%edi, %0; movl %%esi, %1; movl %%ebp, %2;"	\
+		     "movl %%esp, %3; movl %%ebx, %4; movl %%edx, %5;"	\
+		     "movl %%ecx, %6; movl %%eax, %7"			\
+		     : "=m" ((r)->reg_edi), "=m" ((r)->reg_esi),	\
+		       "=m" ((r)->reg_ebp), "=m" ((r)->reg_oesp),	\
+		       "=m" ((r)->reg_ebx), "=m" ((r)->reg_edx),	\
+		       "=m" ((r)->reg_ecx), "=m" ((r)->reg_eax))
+
+// Forget any dump from before this boot.
+void crashdump_init(void);
+
+// Write the dump for a panic at 'file':'line', called from 'eip', with
+// the message 'fmt' and its arguments, and the general registers from
+// crashdump_save_regs.
+void crashdump_write(const char *file, int line, uintptr_t eip,
+		     const struct PushRegs *regs, const char *fmt, va_list ap);
+
+#endif	// !JOS_KERN_CRASHDUMP_H
@@ -0,0 +1,196 @@
+// Function entry/exit tracing.
+//
+// Code compiled with -finstrument-functions calls
+// __cyg_profile_func_enter and __cyg_profile_func_exit around every
+// function.  Each appends a timestamped record to a ring and returns,
+// so the cost is an rdtsc and a few stores; all the analysis happens
+// when someone asks for a report.  This file itself must not be
+// instrumented.
+//
+// The kernel runs on a single CPU, so there is a single ring.  Slots
+// are claimed with an xadd, which is atomic with respect to interrupts
+// on one CPU, so an instrumented interrupt handler can't collide with
+// the code it interrupted.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/ftrace.h>
+#include <kern/backtrace.h>
+#include <kern/kdebug.h>
+
+#define NOTRACE	__attribute__((no_instrument_function))
+
+static struct {
+	volatile bool on;
+	volatile uint32_t head;		// records ever made; next slot
+	struct FtraceRecord rec[FTRACE_NRECORDS];
+} ftrace_ring;
+
+void __cyg_profile_func_enter(void *fn, void *site) NOTRACE;
+void __cyg_profile_func_exit(void *fn, void *site) NOTRACE;
+
+static inline void NOTRACE
+ftrace_record(void *fn, void *site)
+{
+	struct FtraceRecord *r;
+	uint32_t slot = 1;
+
+	if (!ftrace_ring.on)
+		return;
+	asm volatile("xaddl %0, %1"
+		     : "+r" (slot), "+m" (ftrace_ring.head) : : "cc");
+	r = &ftrace_ring.rec[slot % FTRACE_NRECORDS];
+	r->ft_tsc = read_tsc();
+	r->ft_fn = (uintptr_t) fn;
+	r->ft_site = (uintptr_t) site;
+}
+
+void
+__cyg_profile_func_enter(void *fn, void *site)
+{
+	ftrace_record(fn, site);
+}
+
+void
+__cyg_profile_func_exit(void *fn, void *site)
+{
+	ftrace_record(fn, NULL);
+}
+
+void
+ftrace_enable(bool on)
+{
+	ftrace_ring.on = on;
+}
+
+void
+ftrace_clear(void)
+{
+	bool was = ftrace_ring.on;
+
+	ftrace_ring.on = 0;
+	ftrace_ring.head = 0;
+	ftrace_ring.on = was;
+}
+
+
+/***** Reports *****/
+
+struct FtraceFunc {
+	uintptr_t fn;			// 0 if empty
+	uint32_t calls;
+	uint64_t incl;			// cycles in the function and its callees
+	uint64_t excl;			// cycles in the function itself
+};
+
+static struct FtraceFunc *
+ftrace_func(struct FtraceFunc *funcs, uintptr_t fn)
+{
+	uint32_t h = fn * 2654435761U >> 16;
+	int i;
+
+	for (i = 0; i < FTRACE_NFUNCS; i++) {
+		struct FtraceFunc *f = &funcs[(h + i) % FTRACE_NFUNCS];
+		if (f->fn == fn)
+			return f;
+		if (f->fn == 0) {
+			f->fn = fn;
+			return f;
+		}
+	}
+	return NULL;
+}
+
+void
+ftrace_report(int n)
+{
+	static struct FtraceFunc funcs[FTRACE_NFUNCS];
+	static struct {
+		uintptr_t fn;
+		uint64_t tsc;
+		uint64_t child;		// cycles spent in callees
+	} stack[FTRACE_MAXDEPTH];
+	struct FtraceRecord *r;
+	struct FtraceFunc *f, t;
+	struct Eipdebuginfo info;
+	uint32_t head, seq, lost = 0, unmatched = 0, nfuncs;
+	uint64_t incl;
+	bool was = ftrace_ring.on;
+	int depth = 0, i, j;
+
+	// Stop recording, so that we don't trace ourselves.
+	ftrace_ring.on = 0;
+	head = ftrace_ring.head;
+	seq = 0;
+	if (head > FTRACE_NRECORDS) {
+		seq = head - FTRACE_NRECORDS;
+		lost = seq;
+	}
+
+	memset(funcs, 0, sizeof(funcs));
+	for (; seq != head; seq++) {
+		r = &ftrace_ring.rec[seq % FTRACE_NRECORDS];
+		if (r->ft_site) {
+			if (depth < FTRACE_MAXDEPTH) {
+				stack[depth].fn = r->ft_fn;
+				stack[depth].tsc = r->ft_tsc;
+				stack[depth].child = 0;
+			}
+			depth++;
+			continue;
+		}
+
+		// A return.  If it doesn't match the last call (its call
+		// fell off the ring, say), start over from here.
+		if (depth == 0 || (depth <= FTRACE_MAXDEPTH
+				   && stack[depth - 1].fn != r->ft_fn)) {
+			unmatched++;
+			depth = 0;
+			continue;
+		}
+		if (--depth >= FTRACE_MAXDEPTH)
+			continue;
+
+		incl = r->ft_tsc - stack[depth].tsc;
+		if (depth > 0)
+			stack[depth - 1].child += incl;
+		if (!(f = ftrace_func(funcs, r->ft_fn)))
+			continue;
+		f->calls++;
+		f->excl += incl - stack[depth].child;
+		// Count a recursive function's time once, at the outermost call.
+		for (i = 0; i < depth && stack[i].fn != r->ft_fn; i++)
+			/* do nothing */;
+		if (i == depth)
+			f->incl += incl;
+	}
+
+	// Gather the functions at the front, most exclusive cycles first.
+	for (i = nfuncs = 0; i < FTRACE_NFUNCS; i++)
+		if (funcs[i].fn)
+			funcs[nfuncs++] = funcs[i];
+	for (i = 1; i < nfuncs; i++) {
+		t = funcs[i];
+		for (j = i; j > 0 && funcs[j - 1].excl < t.excl; j--)
+			funcs[j] = funcs[j - 1];
+		funcs[j] = t;
+	}
+
+	cprintf("ftrace: %u records, %u lost, %u returns unmatched\n",
+		head - lost, lost, unmatched);
+	cprintf("     calls       inclusive       exclusive  function\n");
+	if (n <= 0 || n > nfuncs)
+		n = nfuncs;
+	for (i = 0; i < n; i++) {
+		cprintf("  %8u %15llu %15llu  ",
+			funcs[i].calls, funcs[i].incl, funcs[i].excl);
+		if (backtrace_symbolize(funcs[i].fn, &info) == 0)
+			cprintf("%.*s\n", info.eip_fn_namelen, info.eip_fn_name);
+		else
+			cprintf("%08x\n", funcs[i].fn);
+	}
+
+	ftrace_ring.on = was;
+}
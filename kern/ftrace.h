@@ -0,0 +1,34 @@
+#ifndef JOS_KERN_FTRACE_H
+#define JOS_KERN_FTRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Function entry/exit tracing, for code built with -finstrument-functions
+// (see KERN_INSTRUMENT in kern/Makefrag).
+
+// Number of records the ring holds (a power of two).
+#define FTRACE_NRECORDS		16384
+// Deepest call nesting the report follows.
+#define FTRACE_MAXDEPTH		64
+// Most distinct functions the report counts (a power of two).
+#define FTRACE_NFUNCS		512
+
+struct FtraceRecord {
+	uint64_t ft_tsc;
+	uintptr_t ft_fn;		// the function entered or left
+	uintptr_t ft_site;		// its call site, or 0 for a return
+};
+
+// Start or stop recording.  Tracing starts off.
+void ftrace_enable(bool on);
+// Throw away all records.
+void ftrace_clear(void);
+// Match up the calls and returns in the ring and print the 'n'
+// functions with the most exclusive cycles, with their inclusive
+// cycles and call counts.
+void ftrace_report(int n);
+
+#endif	// !JOS_KERN_FTRACE_H
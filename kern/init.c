@@ -3,33 +3,81 @@
 #include <inc/stdio.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
 
 #include <kern/monitor.h>
 #include <kern/console.h>
 #include <kern/pmap.h>
 #include <kern/kclock.h>
-
+#include <kern/trap.h>
+#include <kern/picirq.h>
+#include <kern/trace.h>
+#include <kern/backtrace.h>
+#include <kern/boottime.h>
+#include <kern/crashdump.h>
+
+// CPUID function 1 %edx feature bits
+#define CPUID_FXSR	(1 << 24)
+#define CPUID_SSE2	(1 << 26)
+
+// Enable SSE if the CPU has SSE2, so that lib/string.c can use it.
+static void
+sse_init(void)
+{
+	uint32_t edx;
+
+	cpuid(1, NULL, NULL, NULL, &edx);
+	if ((edx & (CPUID_FXSR | CPUID_SSE2)) != (CPUID_FXSR | CPUID_SSE2))
+		return;
+	lcr0((rcr0() & ~CR0_EM) | CR0_MP);
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	string_sse2 = 1;
+}
 
 void
 i386_init(void)
 {
 	extern char edata[], end[];
+	uint64_t start = read_tsc();
 
 	// Before doing anything else, complete the ELF loading process.
 	// Clear the uninitialized global data (BSS) section of our program.
 	// This ensures that all static/global variables start out zero.
 	memset(edata, 0, end - edata);
+	boottime_init(start);
+	boottime_mark("bss");
+
+	// A crash dump from before this boot would only mislead.
+	crashdump_init();
+
+	sse_init();
+
+	// Calibrate the TSC, so that everything after this can tell time.
+	ktime_init();
+	boottime_mark("ktime_init");
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boottime_mark("cons_init");
+
+	// Start streaming trace records, if there is somewhere to send them.
+	trace_sink_init();
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
 	// Lab 2 memory management initialization functions
 	mem_init();
 
+	// Interrupt handling.  The kernel runs with interrupts disabled;
+	// they are only enabled while the console waits for input.
+	trap_init();
+	pic_init();
+	boottime_mark("interrupts");
+
 	// Drop into the kernel monitor.
+	boottime_mark("monitor");
 	while (1)
 		monitor(NULL);
 }
@@ -43,13 +91,16 @@ const char *panicstr;
 
 /*
  * Panic is called on unresolvable fatal errors.
- * It prints "panic: mesg", and then enters the kernel monitor.
+ * It writes a crash dump (see kern/crashdump.h), prints "panic: mesg",
+ * and then enters the kernel monitor.
  */
 void
 _panic(const char *file, int line, const char *fmt,...)
 {
+	struct PushRegs regs;
 	va_list ap;
 
+	crashdump_save_regs(&regs);
 	if (panicstr)
 		goto dead;
 	panicstr = fmt;
@@ -57,11 +108,23 @@ _panic(const char *file, int line, const char *fmt,...)
 	// Be extra sure that the machine is in as reasonable state
 	asm volatile("cli; cld");
 
+	// The dump first, in case printing is what fails
+	va_start(ap, fmt);
+	crashdump_write(file, line, (uintptr_t) __builtin_return_address(0),
+			&regs, fmt, ap);
+	va_end(ap);
+
 	va_start(ap, fmt);
 	cprintf("kernel panic at %s:%d: ", file, line);
 	vcprintf(fmt, ap);
 	cprintf("\n");
 	va_end(ap);
+	backtrace_print(read_ebp());
+	cprintf("crash dump at physical %08x; fetch it with ./crash-dump --fetch\n",
+		CRASHDUMP_PADDR);
+
+	// Get the trace leading up to this out while we still can.
+	trace_sink_drain(0);
 
 dead:
 	/* break into the kernel monitor */
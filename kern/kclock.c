@@ -1,6 +1,7 @@
 /* See COPYRIGHT for copyright information. */
 
-/* Support for reading the NVRAM from the real-time clock. */
+/* Support for reading the NVRAM from the real-time clock,
+ * and for programming the interval timer. */
 
 #include <inc/x86.h>
 
@@ -20,3 +21,170 @@ mc146818_write(unsigned reg, unsigned datum)
 	outb(IO_RTC, reg);
 	outb(IO_RTC+1, datum);
 }
+
+// Make channel 0 of the interval timer interrupt 'hz' times a second,
+// as near as its 16-bit divisor allows.  Returns the actual rate.
+unsigned
+pit_setrate(unsigned hz)
+{
+	unsigned divisor = hz ? (TIMER_FREQ + hz / 2) / hz : 0x10000;
+
+	if (divisor < 2)
+		divisor = 2;
+	if (divisor > 0x10000)
+		divisor = 0x10000;	// written as 0
+	outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+	outb(IO_TIMER1, divisor & 0xff);
+	outb(IO_TIMER1, (divisor >> 8) & 0xff);
+	return (TIMER_FREQ + divisor / 2) / divisor;
+}
+
+
+/***** Real-time clock *****/
+
+static unsigned
+rtc_field(unsigned reg, unsigned regb)
+{
+	unsigned v = mc146818_read(reg);
+
+	if (regb & MC_REGB_BINARY)
+		return v;
+	return (v >> 4) * 10 + (v & 0xf);
+}
+
+// Days from 1970-01-01 to the given date.
+static uint32_t
+days_since_epoch(unsigned year, unsigned month, unsigned day)
+{
+	// Count years from March, so that the leap day ends a year.
+	if (month <= 2)
+		year--;
+	month = (month + 9) % 12;	// March is 0
+	return year * 365 + year / 4 - year / 100 + year / 400
+		+ (153 * month + 2) / 5 + day - 1 - 719468;
+}
+
+uint32_t
+rtc_time(void)
+{
+	unsigned regb, sec, min, hour, day, month, year, pm;
+
+	regb = mc146818_read(MC_REGB);
+	// The clock registers are inconsistent while an update is in
+	// progress, and one can start while we read, so read until we
+	// get the same second twice with no update in between.
+	do {
+		while (mc146818_read(MC_REGA) & MC_REGA_UIP)
+			/* do nothing */;
+		sec = rtc_field(MC_SEC, regb);
+		min = rtc_field(MC_MIN, regb);
+		hour = mc146818_read(MC_HOUR);
+		day = rtc_field(MC_DAY, regb);
+		month = rtc_field(MC_MONTH, regb);
+		year = rtc_field(MC_YEAR, regb);
+	} while ((mc146818_read(MC_REGA) & MC_REGA_UIP)
+		 || rtc_field(MC_SEC, regb) != sec);
+
+	pm = hour & 0x80;
+	hour &= 0x7f;
+	if (!(regb & MC_REGB_BINARY))
+		hour = (hour >> 4) * 10 + (hour & 0xf);
+	if (!(regb & MC_REGB_24HR))
+		hour = hour % 12 + (pm ? 12 : 0);
+
+	return ((days_since_epoch(2000 + year, month, day) * 24 + hour) * 60
+		+ min) * 60 + sec;
+}
+
+
+/***** TSC calibration *****/
+
+#define CALIB_RUNS	5
+#define CALIB_HZ	100		// 10ms windows
+
+// Reads of port B to give up after, should channel 2 never fire.
+#define CALIB_MAXPOLL	(1 << 20)
+
+struct KtimeCalib ktime_calib;
+
+// Count TSC cycles while PIT channel 2 counts down 'latch' ticks.
+// Returns 0 if the channel never finished.
+static uint64_t
+calib_window(unsigned latch)
+{
+	uint64_t start;
+	int i;
+
+	// Raise the gate, with the speaker off, and load a one-shot
+	// count; the output goes high when it runs out.
+	outb(IO_PPI, (inb(IO_PPI) & ~PPI_SPKR) | PPI_GATE2);
+	outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+	outb(TIMER_CNTR2, latch & 0xff);
+	outb(TIMER_CNTR2, latch >> 8);
+
+	start = read_tsc();
+	for (i = 0; i < CALIB_MAXPOLL; i++)
+		if (inb(IO_PPI) & PPI_OUT2)
+			return read_tsc() - start;
+	return 0;
+}
+
+// Measure the TSC rate against the PIT, which runs at a known
+// TIMER_FREQ, and set up ktime.  Takes the median of several short
+// windows, so one that an SMI or a busy host stretches doesn't count.
+void
+ktime_init(void)
+{
+	const unsigned latch = TIMER_FREQ / CALIB_HZ;
+	uint64_t runs[CALIB_RUNS], t;
+	uint32_t khz;
+	int i, j;
+
+	for (i = 0; i < CALIB_RUNS; i++) {
+		t = calib_window(latch);
+		for (j = i; j > 0 && runs[j - 1] > t; j--)
+			runs[j] = runs[j - 1];
+		runs[j] = t;
+	}
+	outb(IO_PPI, inb(IO_PPI) & ~PPI_GATE2);
+
+	ktime_calib.runs = CALIB_RUNS;
+	ktime_calib.window_us = (uint64_t) latch * 1000000 / TIMER_FREQ;
+	ktime_calib.rtc_boot = rtc_time();
+	ktime_calib.boot_tsc = read_tsc();
+	if (runs[0] == 0)
+		return;
+
+	t = runs[CALIB_RUNS / 2];
+	khz = t * TIMER_FREQ / ((uint64_t) latch * 1000);
+	ktime_calib.tsc_khz = khz;
+	ktime_calib.mult = (1000000ULL << KTIME_SHIFT) / khz;
+	ktime_calib.spread_ppm = (runs[CALIB_RUNS - 1] - runs[0]) * 1000000 / t;
+}
+
+// Count TSC cycles over 'secs' ticks of the real-time clock, from one
+// change of its seconds register to another.  Returns 0 if the clock
+// doesn't seem to be ticking.
+uint64_t
+ktime_rtc_cycles(unsigned secs)
+{
+	uint64_t start = 0, timeout = (uint64_t) ktime_calib.tsc_khz * 2000;
+	uint64_t t;
+	unsigned i, sec, last;
+
+	if (timeout == 0)
+		return 0;
+	for (i = 0; i <= secs; i++) {
+		last = mc146818_read(MC_SEC);
+		t = read_tsc();
+		do {
+			if (read_tsc() - t > timeout)
+				return 0;
+			while (mc146818_read(MC_REGA) & MC_REGA_UIP)
+				/* do nothing */;
+		} while ((sec = mc146818_read(MC_SEC)) == last);
+		if (i == 0)
+			start = read_tsc();
+	}
+	return read_tsc() - start;
+}
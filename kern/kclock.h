@@ -6,8 +6,25 @@
 # error "This is a JOS kernel header; user programs should not #include it"
 #endif
 
+#include <inc/types.h>
+#include <inc/x86.h>
+
 #define	IO_RTC		0x070		/* RTC port */
 
+/* Clock registers, in BCD unless MC_REGB_BINARY is set */
+#define	MC_SEC		0x00
+#define	MC_MIN		0x02
+#define	MC_HOUR		0x04		/* bit 7 is PM in 12-hour mode */
+#define	MC_DAY		0x07
+#define	MC_MONTH	0x08
+#define	MC_YEAR		0x09		/* years since 2000 */
+
+#define	MC_REGA		0x0a
+#define	MC_REGA_UIP	0x80		/* update in progress */
+#define	MC_REGB		0x0b
+#define	MC_REGB_24HR	0x02		/* 24-hour mode */
+#define	MC_REGB_BINARY	0x04		/* binary, not BCD */
+
 #define	MC_NVRAM_START	0xe	/* start of NVRAM: offset 14 */
 #define	MC_NVRAM_SIZE	50	/* 50 bytes of NVRAM */
 
@@ -26,4 +43,72 @@
 unsigned mc146818_read(unsigned reg);
 void mc146818_write(unsigned reg, unsigned datum);
 
+/* The 8253/8254 programmable interval timer.  Channel 0 drives IRQ 0. */
+#define	IO_TIMER1	0x040		/* channel 0 counter */
+#define	TIMER_MODE	(IO_TIMER1 + 3)	/* mode/command register */
+#define	TIMER_FREQ	1193182		/* input clock, Hz */
+
+#define	TIMER_CNTR2	(IO_TIMER1 + 2)	/* channel 2 counter */
+
+#define	TIMER_SEL0	0x00		/* select channel 0 */
+#define	TIMER_SEL2	0x80		/* select channel 2 */
+#define	TIMER_INTTC	0x00		/* mode 0: interrupt on terminal count */
+#define	TIMER_RATEGEN	0x04		/* mode 2: rate generator */
+#define	TIMER_16BIT	0x30		/* write low byte, then high byte */
+
+/* Channel 2 is gated, and its output read, through the keyboard
+ * controller's port B. */
+#define	IO_PPI		0x061
+#define	PPI_GATE2	0x01		/* channel 2 gate */
+#define	PPI_SPKR	0x02		/* channel 2 drives the speaker */
+#define	PPI_OUT2	0x20		/* channel 2 output (read only) */
+
+unsigned pit_setrate(unsigned hz);
+
+// Seconds since 1970 by the real-time clock.
+uint32_t rtc_time(void);
+
+/* Monotonic time from the TSC, calibrated against the PIT at boot. */
+
+// ns = cycles * mult >> KTIME_SHIFT
+#define KTIME_SHIFT	22
+
+// What the boot-time calibration measured.
+struct KtimeCalib {
+	uint64_t boot_tsc;		// TSC when calibration finished
+	uint32_t tsc_khz;		// TSC rate (0 if calibration failed)
+	uint32_t mult;			// see KTIME_SHIFT
+	uint32_t runs;			// PIT windows timed
+	uint32_t window_us;		// length of each window
+	uint32_t spread_ppm;		// spread of the runs around the median
+	uint32_t rtc_boot;		// rtc_time() at boot
+};
+
+extern struct KtimeCalib ktime_calib;
+
+void ktime_init(void);
+uint64_t ktime_rtc_cycles(unsigned secs);
+
+// TSC cycles since boot.
+static inline uint64_t
+ktime_cycles(void)
+{
+	return read_tsc() - ktime_calib.boot_tsc;
+}
+
+// Convert a count of TSC cycles to nanoseconds.
+static inline uint64_t
+cycles_to_ns(uint64_t cycles)
+{
+	return ((cycles & 0xffffffff) * ktime_calib.mult >> KTIME_SHIFT)
+		+ ((cycles >> 32) * ktime_calib.mult << (32 - KTIME_SHIFT));
+}
+
+// Nanoseconds since boot.  0 forever if calibration failed.
+static inline uint64_t
+ktime_ns(void)
+{
+	return cycles_to_ns(ktime_cycles());
+}
+
 #endif	// !JOS_KERN_KCLOCK_H
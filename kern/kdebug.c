@@ -10,6 +10,57 @@ extern const struct Stab __STAB_END__[];	// End of stabs table
 extern const char __STABSTR_BEGIN__[];		// Beginning of string table
 extern const char __STABSTR_END__[];		// End of string table
 
+// The debug table that kern/mkdebugtab.pl builds from the stabs (or
+// DWARF line tables) of a first link of the kernel.  It holds a sorted
+// array of function start addresses, to binary search, and a parallel
+// array of DebugFuncs.  Each function's line numbers are a run of rows,
+// each giving the address delta from the previous row (shifted left
+// one, with bit 0 set if the source file changes) as a ULEB128, the
+// line delta as an SLEB128, and then, if the file changed, the new
+// file name's string offset as a ULEB128.
+//
+// Kernels built with DWARF also get the calls the compiler inlined: a
+// sorted array of addresses, each starting a run of code with the same
+// chain of inlined calls, and a parallel array of DebugInlines pointing
+// at each run's chain in an array of DebugCalls, innermost call first.
+#define DEBUGTAB_MAGIC	0x44424754
+
+struct DebugTab {
+	uint32_t dt_magic;
+	uint32_t dt_nfuncs;
+	uint32_t dt_addrs;	// Offset of uintptr_t[dt_nfuncs]
+	uint32_t dt_funcs;	// Offset of struct DebugFunc[dt_nfuncs]
+	uint32_t dt_rows;	// Offset of the line rows
+	uint32_t dt_strs;	// Offset of the string table
+	uintptr_t dt_etext;	// End of the last function
+	uint32_t dt_ninlines;
+	uint32_t dt_inline_addrs; // Offset of uintptr_t[dt_ninlines]
+	uint32_t dt_inlines;	// Offset of struct DebugInline[dt_ninlines]
+	uint32_t dt_calls;	// Offset of the struct DebugCalls
+};
+
+struct DebugFunc {
+	uint32_t df_name;	// String offset of the function name
+	uint32_t df_file;	// String offset of the file at its start
+	uint32_t df_rows;	// Offset of its first row from dt_rows
+	uint16_t df_nrows;
+	uint16_t df_narg;
+	int32_t df_line;	// Line number at its start
+} __attribute__((packed));
+
+struct DebugInline {
+	uint32_t di_call;	// Index of its innermost DebugCall
+	uint32_t di_ncalls;	// 0 if nothing is inlined here
+};
+
+struct DebugCall {
+	uint32_t dc_name;	// String offset of the function inlined
+	uint32_t dc_file;	// String offset of the caller's file
+	int32_t dc_line;	// and the line of the call
+};
+
+extern const struct DebugTab debugtab;
+
 
 // stab_binsearch(stabs, region_left, region_right, type, addr)
 //
@@ -94,6 +145,64 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 }
 
 
+static void
+debuginfo_init(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	info->eip_file = "<unknown>";
+	info->eip_line = 0;
+	info->eip_fn_name = "<unknown>";
+	info->eip_fn_namelen = 9;
+	info->eip_fn_addr = addr;
+	info->eip_fn_narg = 0;
+}
+
+static uint32_t
+uleb128(const uint8_t **p)
+{
+	uint32_t v = 0;
+	int shift = 0;
+
+	do {
+		v |= (uint32_t) (**p & 0x7f) << shift;
+		shift += 7;
+	} while (*(*p)++ & 0x80);
+	return v;
+}
+
+static int32_t
+sleb128(const uint8_t **p)
+{
+	uint32_t v = 0;
+	int shift = 0;
+	uint8_t byte;
+
+	do {
+		byte = *(*p)++;
+		v |= (uint32_t) (byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	if (shift < 32 && (byte & 0x40))
+		v |= -(1U << shift);
+	return v;
+}
+
+// Index of the last of the 'n' sorted 'addrs' at or before 'addr',
+// which must be at or after the first.
+static int
+addr_search(const uintptr_t *addrs, int n, uintptr_t addr)
+{
+	int l = 0, r = n - 1, m;
+
+	while (l < r) {
+		m = (l + r + 1) / 2;
+		if (addrs[m] <= addr)
+			l = m;
+		else
+			r = m - 1;
+	}
+	return l;
+}
+
 // debuginfo_eip(addr, info)
 //
 //	Fill in the 'info' structure with information about the specified
@@ -101,20 +210,107 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 //	negative if not.  But even if it returns negative it has stored some
 //	information into '*info'.
 //
+//	This uses the prebuilt debug table: a binary search for the
+//	function, then a walk over that function's line rows.  The
+//	kernel from the first link has an empty table, and falls back to
+//	the stabs.
+//
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	const char *base = (const char *) &debugtab, *strs;
+	const uintptr_t *addrs;
+	const struct DebugFunc *fn;
+	const uint8_t *row;
+	uintptr_t rowaddr;
+	uint32_t delta;
+	int l, i;
+
+	if (debugtab.dt_magic != DEBUGTAB_MAGIC || debugtab.dt_nfuncs == 0)
+		return debuginfo_eip_stabs(addr, info);
+
+	debuginfo_init(addr, info);
+	addrs = (const uintptr_t *) (base + debugtab.dt_addrs);
+	strs = base + debugtab.dt_strs;
+	if (addr < addrs[0] || addr >= debugtab.dt_etext)
+		return -1;
+
+	// Find the last function starting at or before 'addr'
+	l = addr_search(addrs, debugtab.dt_nfuncs, addr);
+	fn = (const struct DebugFunc *) (base + debugtab.dt_funcs) + l;
+
+	info->eip_fn_name = strs + fn->df_name;
+	info->eip_fn_namelen = strlen(info->eip_fn_name);
+	info->eip_fn_addr = addrs[l];
+	info->eip_fn_narg = fn->df_narg;
+	info->eip_file = strs + fn->df_file;
+	info->eip_line = fn->df_line;
+
+	// Replay the rows up to 'addr'
+	row = (const uint8_t *) base + debugtab.dt_rows + fn->df_rows;
+	rowaddr = addrs[l];
+	for (i = 0; i < fn->df_nrows; i++) {
+		delta = uleb128(&row);
+		rowaddr += delta >> 1;
+		if (rowaddr > addr)
+			break;
+		info->eip_line += sleb128(&row);
+		if (delta & 1)
+			info->eip_file = strs + uleb128(&row);
+	}
+	return 0;
+}
+
+// debuginfo_inline(addr, inl, max)
+//
+//	Store the calls the compiler inlined at 'addr' in 'inl', innermost
+//	first, up to 'max' of them, and return how many it stored.  The
+//	line debuginfo_eip gives for 'addr' is in the innermost function
+//	inlined; each call's file and line are in the next one out, and
+//	the outermost call's are in the function debuginfo_eip names.
+//	Returns 0 if nothing is inlined at 'addr', or if the kernel has no
+//	record of inlining (the stabs don't).
+//
+int
+debuginfo_inline(uintptr_t addr, struct Eipinline *inl, int max)
+{
+	const char *base = (const char *) &debugtab, *strs;
+	const uintptr_t *addrs;
+	const struct DebugInline *run;
+	const struct DebugCall *call;
+	int i;
+
+	if (debugtab.dt_magic != DEBUGTAB_MAGIC || debugtab.dt_ninlines == 0)
+		return 0;
+	addrs = (const uintptr_t *) (base + debugtab.dt_inline_addrs);
+	strs = base + debugtab.dt_strs;
+	if (addr < addrs[0] || addr >= debugtab.dt_etext)
+		return 0;
+
+	run = (const struct DebugInline *) (base + debugtab.dt_inlines)
+		+ addr_search(addrs, debugtab.dt_ninlines, addr);
+	call = (const struct DebugCall *) (base + debugtab.dt_calls)
+		+ run->di_call;
+	for (i = 0; i < (int) run->di_ncalls && i < max; i++, call++) {
+		inl[i].inl_fn_name = strs + call->dc_name;
+		inl[i].inl_call_file = strs + call->dc_file;
+		inl[i].inl_call_line = call->dc_line;
+	}
+	return i;
+}
+
+// debuginfo_eip_stabs(addr, info)
+//
+//	Like debuginfo_eip, but searches the raw stabs.
+//
+int
+debuginfo_eip_stabs(uintptr_t addr, struct Eipdebuginfo *info)
 {
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
 	int lfile, rfile, lfun, rfun, lline, rline;
 
-	// Initialize *info
-	info->eip_file = "<unknown>";
-	info->eip_line = 0;
-	info->eip_fn_name = "<unknown>";
-	info->eip_fn_namelen = 9;
-	info->eip_fn_addr = addr;
-	info->eip_fn_narg = 0;
+	debuginfo_init(addr, info);
 
 	// Find the relevant set of stabs
 	if (addr >= ULIM) {
@@ -178,7 +374,10 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	//	There's a particular stabs type used for line numbers.
 	//	Look at the STABS documentation and <inc/stab.h> to find
 	//	which one.
-	// Your code here.
+	stab_binsearch(stabs, &lline, &rline, N_SLINE, addr);
+	if (lline > rline)
+		return -1;
+	info->eip_line = stabs[lline].n_desc;
 
 
 	// Search backwards from the line number for the relevant filename
@@ -15,6 +15,15 @@ struct Eipdebuginfo {
 	int eip_fn_narg;		// Number of function arguments
 };
 
+// A call the compiler inlined at an instruction pointer
+struct Eipinline {
+	const char *inl_fn_name;	// Function inlined (null terminated)
+	const char *inl_call_file;	// Where it was called from
+	int inl_call_line;
+};
+
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_eip_stabs(uintptr_t eip, struct Eipdebuginfo *info);
+int debuginfo_inline(uintptr_t eip, struct Eipinline *inl, int max);
 
 #endif
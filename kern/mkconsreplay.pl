@@ -0,0 +1,36 @@
+#!/usr/bin/perl
+#
+# Usage: mkconsreplay.pl <recording>
+#
+# Compiles a console input recording, as ./trace-decode --input writes
+# it, into the replay buffer kern/console.c reads when the kernel is
+# built with CONS_REPLAY, and writes it to stdout as an assembly file.
+#
+# A recording has a line for each input byte: the TSC cycles since the
+# first byte, then the byte in hex.  Blank lines and lines starting
+# with '#' are ignored.  The replay keeps only the bytes; the times are
+# there for reading.
+
+use strict;
+
+my $filename = shift;
+my @bytes;
+
+open(REC, $filename) || die "open $filename: $!";
+while (<REC>) {
+	next if /^\s*(#|$)/;
+	my ($cycles, $byte) = /^\s*(\d+)\s+([0-9a-fA-F]{1,2})\s*$/
+		or die "$filename:$.: bad input record\n";
+	push @bytes, hex($byte);
+}
+close(REC);
+
+print "# Generated by kern/mkconsreplay.pl from $filename; do not edit.\n";
+print "\t.section .rodata\n";
+print "\t.globl cons_replay_start, cons_replay_end\n";
+print "cons_replay_start:\n";
+for (my $i = 0; $i < @bytes; $i += 16) {
+	my $end = $i + 16 < @bytes ? $i + 16 : scalar(@bytes);
+	print "\t.byte ", join(",", @bytes[$i .. $end - 1]), "\n";
+}
+print "cons_replay_end:\n";
@@ -0,0 +1,297 @@
+#!/usr/bin/perl
+#
+# Usage: mkdebugtab.pl <nm -n output> <objdump -G output> <objdump --dwarf=decodedline --wide output> [<addr2line> <kernel>]
+#
+# Builds the kernel's address-to-function/line table (see kern/kdebug.c)
+# from a first-pass link of the kernel, and writes it to stdout as an
+# assembly file.  Functions come from N_FUN stabs, plus any text symbols
+# that have none (assembly code); line numbers come from N_SLINE stabs,
+# or from DWARF line tables if the kernel was built without stabs.
+#
+# With DWARF, the table also records the calls the compiler inlined.
+# addr2line, given the kernel, reports the chain of inlined calls at
+# the start of each line row, which holds until the next one.
+#
+# The table only holds text addresses, and the kernel links text first,
+# so adding the table to the kernel doesn't move anything it describes.
+# With no arguments, writes an empty table for the first-pass link.
+#
+# Keep the layout in step with struct DebugTab in kern/kdebug.c.
+
+use strict;
+use Cwd;
+use File::Temp qw(tempfile);
+
+my $MAGIC = 0x44424754;		# "TGBD"
+
+my %funcs;			# address -> [name, narg]
+my @lines;			# [address, file, line], in input order;
+				# line 0 ends a run of code with line numbers
+my $etext = 0;
+my @inlines;			# [address, [name, call file, call line]...],
+				# innermost call first, sorted
+
+sub readsyms {
+	my $filename = shift;
+
+	open(SYMS, $filename) || die "open $filename: $!";
+	while (<SYMS>) {
+		my ($addr, $type, $name) = split;
+		next unless defined $name;
+		$etext = hex($addr) if $name eq "etext";
+		next unless $type =~ /^[tTwW]$/;
+		$funcs{hex($addr)} //= [$name, 0];
+	}
+	close(SYMS);
+}
+
+sub readstabs {
+	my $filename = shift;
+	my ($file, $fun, $lastfun) = ("<unknown>", undef, undef);
+
+	open(STABS, $filename) || die "open $filename: $!";
+	while (<STABS>) {
+		# Symnum n_type n_othr n_desc n_value n_strx [String]
+		my ($num, $type, $othr, $desc, $value, $strx, $str) =
+			/^\s*(-?\d+)\s+(\w+)\s+(\d+)\s+(\d+)\s+([0-9a-f]{8})\s+(\d+)\s*(.*?)\s*$/
+			or next;
+		$value = hex($value);
+
+		if ($type eq "SO") {
+			# Skip the compilation directory and end-of-file markers
+			$file = $str if $value && $str !~ m{/$};
+			$fun = undef;
+		} elsif ($type eq "SOL") {
+			$file = $str;
+		} elsif ($type eq "FUN") {
+			if ($str eq "") {
+				# End of function; the value is its size
+				push @lines, [$fun + $value, "<unknown>", 0]
+					if defined($fun);
+				$fun = undef;
+			} else {
+				$str =~ s/:.*//;
+				$fun = $value;
+				$lastfun = $funcs{$value} = [$str, 0];
+			}
+		} elsif ($type eq "PSYM") {
+			$lastfun->[1]++ if $lastfun;
+		} elsif ($type eq "SLINE") {
+			# Line stabs are relative to their function
+			push @lines, [defined($fun) ? $fun + $value : $value, $file, $desc];
+		}
+		$lastfun = undef unless $type eq "FUN" || $type eq "PSYM";
+	}
+	close(STABS);
+}
+
+sub readdwarf {
+	my $filename = shift;
+	my $file = "<unknown>";
+
+	open(DWARF, $filename) || die "open $filename: $!";
+	while (<DWARF>) {
+		if (/^(?:CU: )?(\S+):$/) {
+			($file = $1) =~ s{^\./}{};
+		} elsif (/^\S+\s+(\d+)\s+0x([0-9a-f]+)/) {
+			push @lines, [hex($2), $file, $1];
+		} elsif (/^\S+\s+-\s+0x([0-9a-f]+)/) {
+			# End of a sequence
+			push @lines, [hex($1), "<unknown>", 0];
+		}
+	}
+	close(DWARF);
+}
+
+# addr2line's file names are absolute; make them like the line table's
+sub srcname {
+	my $file = shift;
+	my $cwd = getcwd();
+
+	$file =~ s{^\Q$cwd\E/}{};
+	$file =~ s{^\./}{};
+	return $file;
+}
+
+sub readinlines {
+	my ($addr2line, $kernel) = @_;
+	my %seen;
+	my @addrs = grep { !$seen{$_}++ } map { $_->[0] } @lines;
+	push @addrs, grep { !$seen{$_}++ } keys %funcs;
+	@addrs = sort { $a <=> $b } grep { !$etext || $_ < $etext } @addrs;
+
+	my ($tmp, $tmpname) = tempfile(UNLINK => 1);
+	printf $tmp "0x%x\n", $_ foreach @addrs;
+	close($tmp);
+
+	# Each address prints as
+	#   0x<addr>: <innermost function> at <file>:<line>
+	#    (inlined by) <its caller> at <file>:<line>
+	# and so on out to the real function
+	my @chain;
+	my $flush = sub {
+		return unless @chain;
+		my $addr = shift @chain;
+		my @calls;
+		for (my $i = 0; $i + 1 < @chain; $i++) {
+			push @calls, [$chain[$i][0], $chain[$i + 1][1],
+				      $chain[$i + 1][2]];
+		}
+		push @inlines, [$addr, @calls];
+		@chain = ();
+	};
+	open(A2L, "$addr2line -a -i -f -p -e $kernel < $tmpname |")
+		|| die "$addr2line: $!";
+	while (<A2L>) {
+		if (/^0x([0-9a-f]+): (\S+) at (.*?):(\d+|\?)/) {
+			&$flush();
+			@chain = (hex($1), [$2, srcname($3), $4 eq "?" ? 0 : $4]);
+		} elsif (/^ \(inlined by\) (\S+) at (.*?):(\d+|\?)/ && @chain) {
+			push @chain, [$1, srcname($2), $3 eq "?" ? 0 : $3];
+		}
+	}
+	&$flush();
+	close(A2L) || die "$addr2line failed\n";
+}
+
+if (@ARGV) {
+	readsyms($ARGV[0]);
+	readstabs($ARGV[1]);
+	if (!@lines) {
+		readdwarf($ARGV[2]);
+		readinlines($ARGV[3], $ARGV[4]) if @ARGV >= 5;
+	}
+}
+
+# Strings, shared
+my $strtab = "";
+my %stroff;
+sub str {
+	my $s = shift;
+	if (!exists $stroff{$s}) {
+		$stroff{$s} = length($strtab);
+		$strtab .= "$s\0";
+	}
+	return $stroff{$s};
+}
+str("<unknown>");
+
+sub uleb {
+	my $v = shift;
+	my @b;
+	do {
+		my $byte = $v & 0x7f;
+		$v >>= 7;
+		push @b, $v ? $byte | 0x80 : $byte;
+	} while ($v);
+	return @b;
+}
+
+sub sleb {
+	use integer;		# for an arithmetic >>
+	my $v = shift;
+	my @b;
+	while (1) {
+		my $byte = $v & 0x7f;
+		$v >>= 7;
+		if (($v == 0 && !($byte & 0x40)) || ($v == -1 && ($byte & 0x40))) {
+			push @b, $byte;
+			return @b;
+		}
+		push @b, $byte | 0x80;
+	}
+}
+
+# Sort rows by address; for rows at the same address the last one wins,
+# which a stable sort keeps last.
+@lines = sort { $a->[0] <=> $b->[0] } @lines;
+
+my @addrs = sort { $a <=> $b } grep { !$etext || $_ < $etext } keys %funcs;
+my (@info, @rows);
+my $li = 0;
+my ($curfile, $curline) = ("<unknown>", 0);
+for (my $i = 0; $i < @addrs; $i++) {
+	my $start = $addrs[$i];
+	my $end = $i + 1 < @addrs ? $addrs[$i + 1] : ($etext || 0xffffffff);
+
+	# Line state at the start of the function
+	while ($li < @lines && $lines[$li][0] <= $start) {
+		($curfile, $curline) = ($lines[$li][1], $lines[$li][2]);
+		$li++;
+	}
+	my ($file, $line) = ($curfile, $curline);
+	my ($addr, $nrows, $off) = ($start, 0, scalar(@rows));
+
+	# Rows within the function, as deltas from the previous row
+	while ($li < @lines && $lines[$li][0] < $end) {
+		my ($raddr, $rfile, $rline) = @{$lines[$li++]};
+		my $newfile = $rfile ne $curfile;
+		push @rows, uleb(($raddr - $addr) << 1 | $newfile);
+		push @rows, sleb($rline - $curline);
+		push @rows, uleb(str($rfile)) if $newfile;
+		($addr, $curfile, $curline) = ($raddr, $rfile, $rline);
+		$nrows++;
+	}
+	die "too many line rows in $funcs{$start}[0]\n" if $nrows > 0xffff;
+	push @info, [str($funcs{$start}[0]), str($file), $off, $nrows,
+		     $funcs{$start}[1], $line];
+}
+
+# Inlined calls, as runs of addresses with the same chain of calls.
+# Runs with the same chain share its calls.
+my (@inladdrs, @inlruns, @calls, %chainoff);
+my $lastchain;
+foreach (@inlines) {
+	my ($addr, @chain) = @$_;
+	my $key = join("\0", map { @$_ } @chain);
+	next if defined($lastchain) && $key eq $lastchain;
+	$lastchain = $key;
+	if (!exists $chainoff{$key}) {
+		$chainoff{$key} = @calls;
+		push @calls, map { [str($_->[0]), str($_->[1]), $_->[2]] } @chain;
+	}
+	push @inladdrs, $addr;
+	push @inlruns, [$chainoff{$key}, scalar(@chain)];
+}
+# Nothing inlined at all
+@inladdrs = @inlruns = () unless @calls;
+
+# Emit the table
+my $n = @addrs;
+my $ninl = @inladdrs;
+my $hdrsize = 11 * 4;
+my $addroff = $hdrsize;
+my $funcoff = $addroff + 4 * $n;
+my $inladdroff = $funcoff + 20 * $n;
+my $inloff = $inladdroff + 4 * $ninl;
+my $calloff = $inloff + 8 * $ninl;
+my $rowoff = $calloff + 12 * @calls;
+my $stroff = $rowoff + @rows;
+
+print "# Generated by kern/mkdebugtab.pl; do not edit.\n";
+print "\t.section .rodata\n";
+print "\t.p2align 2\n";
+print "\t.globl debugtab\n";
+print "debugtab:\n";
+printf "\t.long 0x%08x, %d, %d, %d, %d, %d, 0x%08x\n",
+	$MAGIC, $n, $addroff, $funcoff, $rowoff, $stroff, $etext;
+printf "\t.long %d, %d, %d, %d\n", $ninl, $inladdroff, $inloff, $calloff;
+printf "\t.long 0x%08x\n", $_ foreach @addrs;
+foreach (@info) {
+	my ($name, $file, $off, $nrows, $narg, $line) = @$_;
+	printf "\t.long %d, %d, %d\n\t.short %d, %d\n\t.long %d\n",
+		$name, $file, $off, $nrows, $narg, $line;
+}
+printf "\t.long 0x%08x\n", $_ foreach @inladdrs;
+printf "\t.long %d, %d\n", @$_ foreach @inlruns;
+printf "\t.long %d, %d, %d\n", @$_ foreach @calls;
+for (my $i = 0; $i < @rows; $i += 16) {
+	my $end = $i + 16 < @rows ? $i + 16 : scalar(@rows);
+	print "\t.byte ", join(",", @rows[$i .. $end - 1]), "\n";
+}
+my @strs = split(/\0/, $strtab, -1);
+pop @strs;			# after the last null
+foreach (@strs) {
+	s/(["\\])/\\$1/g;
+	print "\t.asciz \"$_\"\n";
+}
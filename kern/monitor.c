@@ -10,6 +10,13 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/bench.h>
+#include <kern/trace.h>
+#include <kern/backtrace.h>
+#include <kern/profile.h>
+#include <kern/kclock.h>
+#include <kern/boottime.h>
+#include <kern/ftrace.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -24,6 +31,13 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "backtrace", "Display a backtrace of the kernel stack", mon_backtrace },
+	{ "bench", "Run kernel microbenchmarks: bench [name]", mon_bench },
+	{ "dmesg", "Dump the kernel trace ring: dmesg [count]", mon_dmesg },
+	{ "boottime", "Display the boot timeline", mon_boottime },
+	{ "clock", "Show the TSC calibration and drift vs the RTC: clock [drift [secs]]", mon_clock },
+	{ "ftrace", "Trace instrumented functions: ftrace on|off|clear|report [n]", mon_ftrace },
+	{ "profile", "Sample the kernel: profile start [hz]|stop|report [n]|folded", mon_profile },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -51,16 +65,117 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	cprintf("  end    %08x (virt)  %08x (phys)\n", end, end - KERNBASE);
 	cprintf("Kernel executable memory footprint: %dKB\n",
 		ROUNDUP(end - entry, 1024) / 1024);
+	cprintf("Console input dropped: %u bytes\n", cons_drops());
 	return 0;
 }
 
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
-	// Your code here.
+	backtrace_print(read_ebp());
 	return 0;
 }
 
+int
+mon_bench(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc > 2 || bench_run(argc == 2 ? argv[1] : NULL) < 0) {
+		cprintf("Usage: bench [name]\nBenchmarks:\n");
+		bench_list();
+	}
+	return 0;
+}
+
+int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf)
+{
+	trace_dump(argc > 1 ? strtol(argv[1], NULL, 0) : 0);
+	if (trace_sink_lost())
+		cprintf("trace sink: %u records lost before they were sent\n",
+			trace_sink_lost());
+	return 0;
+}
+
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	boottime_print();
+	return 0;
+}
+
+int
+mon_clock(int argc, char **argv, struct Trapframe *tf)
+{
+	struct KtimeCalib *c = &ktime_calib;
+	uint64_t ns = ktime_ns(), cycles, expect, diff;
+	unsigned secs;
+
+	cprintf("clock: tsc %u kHz, median of %u runs of %u us, spread %u ppm\n",
+		c->tsc_khz, c->runs, c->window_us, c->spread_ppm);
+	if (c->tsc_khz == 0) {
+		cprintf("clock: calibration failed\n");
+		return 0;
+	}
+	// The RTC only counts whole seconds, so this is good to a second.
+	cprintf("clock: up %llu.%03u s by the tsc, %u s by the rtc\n",
+		ns / 1000000000, (uint32_t) (ns / 1000000 % 1000),
+		rtc_time() - c->rtc_boot);
+
+	if (argc < 2 || strcmp(argv[1], "drift") != 0)
+		return 0;
+	secs = argc > 2 ? strtol(argv[2], NULL, 0) : 5;
+	if (secs == 0)
+		secs = 1;
+	if ((cycles = ktime_rtc_cycles(secs)) == 0) {
+		cprintf("clock: the rtc isn't ticking\n");
+		return 0;
+	}
+	expect = (uint64_t) c->tsc_khz * 1000 * secs;
+	diff = cycles > expect ? cycles - expect : expect - cycles;
+	cprintf("clock: over %u s of rtc, tsc ran %llu cycles, drift %c%llu ppm\n",
+		secs, cycles, cycles < expect ? '-' : '+',
+		diff * 1000000 / expect);
+	return 0;
+}
+
+int
+mon_ftrace(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "on") == 0)
+		ftrace_enable(1);
+	else if (argc == 2 && strcmp(argv[1], "off") == 0)
+		ftrace_enable(0);
+	else if (argc == 2 && strcmp(argv[1], "clear") == 0)
+		ftrace_clear();
+	else if (argc >= 2 && strcmp(argv[1], "report") == 0 && argc <= 3)
+		ftrace_report(argc == 3 ? strtol(argv[2], NULL, 0) : 20);
+	else
+		cprintf("Usage: ftrace on | off | clear | report [n]\n"
+			"Only code built with KERN_INSTRUMENT (see kern/Makefrag) is traced.\n");
+	return 0;
+}
+
+int
+mon_profile(int argc, char **argv, struct Trapframe *tf)
+{
+	unsigned hz;
+
+	if (argc >= 2 && strcmp(argv[1], "start") == 0 && argc <= 3) {
+		hz = profile_start(argc == 3 ? strtol(argv[2], NULL, 0) : 0);
+		if (hz)
+			cprintf("profile: sampling at %u Hz\n", hz);
+		else
+			cprintf("profile: no interrupts to sample with\n");
+	} else if (argc == 2 && strcmp(argv[1], "stop") == 0)
+		profile_stop();
+	else if (argc >= 2 && strcmp(argv[1], "report") == 0 && argc <= 3)
+		profile_report(argc == 3 ? strtol(argv[2], NULL, 0) : 20);
+	else if (argc == 2 && strcmp(argv[1], "folded") == 0)
+		profile_folded();
+	else
+		cprintf("Usage: profile start [hz] | stop | report [n] | folded\n");
+	return 0;
+}
 
 
 /***** Kernel monitor command interpreter *****/
@@ -73,7 +188,8 @@ runcmd(char *buf, struct Trapframe *tf)
 {
 	int argc;
 	char *argv[MAXARGS];
-	int i;
+	uint32_t eflags;
+	int i, r;
 
 	// Parse the command buffer into whitespace-separated arguments
 	argc = 0;
@@ -100,8 +216,16 @@ runcmd(char *buf, struct Trapframe *tf)
 	if (argc == 0)
 		return 0;
 	for (i = 0; i < ARRAY_SIZE(commands); i++) {
-		if (strcmp(argv[0], commands[i].name) == 0)
-			return commands[i].func(argc, argv, tf);
+		if (strcmp(argv[0], commands[i].name) != 0)
+			continue;
+		// Commands run with interrupts disabled, like the rest of
+		// the kernel, except while the profiler needs its timer.
+		eflags = read_eflags();
+		if (profile_running())
+			asm volatile("sti");
+		r = commands[i].func(argc, argv, tf);
+		write_eflags(eflags);
+		return r;
 	}
 	cprintf("Unknown command '%s'\n", argv[0]);
 	return 0;
@@ -8,6 +8,9 @@
 
 #include <kern/pmap.h>
 #include <kern/kclock.h>
+#include <kern/trace.h>
+#include <kern/boottime.h>
+#include <kern/crashdump.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;            // Amount of physical memory (in pages)
@@ -131,6 +134,7 @@ mem_init(void) {
 
     // Find out how much memory the machine has (npages & npages_basemem).
     i386_detect_memory();
+    boottime_mark("i386_detect_memory");
 
     //////////////////////////////////////////////////////////////////////
     // create initial page directory.
@@ -163,10 +167,14 @@ mem_init(void) {
     // particular, we can now map memory using boot_map_region
     // or page_insert
     page_init();
+    boottime_mark("page_init");
 
     check_page_free_list(1);
+    boottime_mark("check_page_free_list(1)");
     check_page_alloc();
+    boottime_mark("check_page_alloc");
     check_page();
+    boottime_mark("check_page");
 
     //////////////////////////////////////////////////////////////////////
     // Now we set up virtual memory
@@ -180,6 +188,7 @@ mem_init(void) {
     //    - pages itself -- kernel RW, user NONE
     // Your code goes here:
     boot_map_region(kern_pgdir, UPAGES, npages* sizeof(struct PageInfo), PADDR(pages), PTE_U | PTE_P);
+    boottime_mark("boot_map_region(UPAGES)");
 
     //////////////////////////////////////////////////////////////////////
     // Use the physical memory that 'bootstack' refers to as the kernel
@@ -193,6 +202,7 @@ mem_init(void) {
     //     Permissions: kernel RW, user NONE
     // Your code goes here:
     boot_map_region(kern_pgdir, KSTACKTOP-KSTKSIZE, KSTKSIZE, PADDR(bootstack), PTE_W);
+    boottime_mark("boot_map_region(KSTACK)");
 
     //////////////////////////////////////////////////////////////////////
     // Map all of physical memory at KERNBASE.
@@ -204,9 +214,11 @@ mem_init(void) {
     // Your code goes here:
     // 2^32 => 0xffffffff
     boot_map_region(kern_pgdir, KERNBASE, 0xffffffff - KERNBASE, 0, PTE_W);
+    boottime_mark("boot_map_region(KERNBASE)");
 
     // Check that the initial page directory has been set up correctly.
     check_kern_pgdir();
+    boottime_mark("check_kern_pgdir");
 
     // Switch from the minimal entry page directory to the full kern_pgdir
     // page table we just created.	Our instruction pointer should be
@@ -216,8 +228,10 @@ mem_init(void) {
     // If the machine reboots at this point, you've probably set up your
     // kern_pgdir wrong.
     lcr3(PADDR(kern_pgdir));
+    boottime_mark("lcr3");
 
     check_page_free_list(0);
+    boottime_mark("check_page_free_list(0)");
 
     // entry.S set the really important flags in cr0 (including enabling
     // paging).  Here we configure the rest of the flags that we care about.
@@ -228,6 +242,7 @@ mem_init(void) {
 
     // Some more checks, only possible after kern_pgdir is installed.
     check_page_installed_pgdir();
+    boottime_mark("check_page_installed_pgdir");
 }
 
 // --------------------------------------------------------------
@@ -249,8 +264,14 @@ page_init(void) {
     pages[0].pp_ref = 1;
 
     //  2) The rest of base memory, [PGSIZE, npages_basemem * PGSIZE) is free.
+    //     Except the crash dump region, which _panic writes into.
     size_t i;
     for (i = 1; i < npages_basemem; i++) {
+        if (i >= PGNUM(CRASHDUMP_PADDR)
+            && i < PGNUM(CRASHDUMP_PADDR + CRASHDUMP_SIZE)) {
+            pages[i].pp_ref = 1;
+            continue;
+        }
         pages[i].pp_ref = 0;
         pages[i].pp_link = page_free_list;
         page_free_list = &pages[i];
@@ -306,8 +327,9 @@ page_alloc(int alloc_flags) {
         // 反馈kernel地址
         // returned physical page with '\0' bytes
         // 只要分配空间，不需要counter加1
-        memset(page2kva(page_to_alloc), '\0', PGSIZE);
+        page_zero(page_to_alloc);
     }
+    trace("page_alloc %08x flags %x", page2pa(page_to_alloc), alloc_flags);
     return page_to_alloc;
 }
 
@@ -322,6 +344,7 @@ page_free(struct PageInfo *pp) {
     }
     pp->pp_link = page_free_list;
     page_free_list = pp;
+    trace("page_free %08x", page2pa(pp));
 }
 
 //
@@ -334,6 +357,117 @@ page_decref(struct PageInfo *pp) {
         page_free(pp);
 }
 
+//
+// Count and bound the pages on page_free_list, for crash dumps.  The
+// list may be what's wrong, so every link is checked before it is
+// followed, and the walk gives up at the first bad one.
+//
+void
+page_free_stats(struct PageFreeStats *stats) {
+    struct PageInfo *pp;
+    physaddr_t pa;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->pfs_lowest = ~0;
+    for (pp = page_free_list; pp; pp = pp->pp_link) {
+        if (pp < pages || pp >= pages + npages
+            || ((char *) pp - (char *) pages) % sizeof(*pp) != 0
+            || stats->pfs_nfree == npages) {
+            stats->pfs_corrupt = 1;
+            break;
+        }
+        pa = page2pa(pp);
+        if (stats->pfs_nfree++ == 0)
+            stats->pfs_head = pa;
+        stats->pfs_lowest = MIN(stats->pfs_lowest, pa);
+        stats->pfs_highest = MAX(stats->pfs_highest, pa);
+    }
+    if (stats->pfs_nfree == 0)
+        stats->pfs_lowest = 0;
+}
+
+//
+// Zero or copy a whole page with non-temporal (streaming) stores, which
+// go around the cache, so that clearing a page doesn't evict data the
+// kernel is using.  Streaming stores are weakly ordered; the sfence
+// makes them visible before we return.
+//
+// movntdq goes through %xmm registers, so, as in lib/string.c, it is
+// only used with interrupts off; otherwise movnti streams from general
+// registers.  Without SSE2 these are just
+// memset and memcpy.  The pointer increments take their size from the
+// register, so that the native test build (test/pmapsim.c) assembles.
+//
+void
+page_zero(struct PageInfo *pp) {
+    void *p = page2kva(pp);
+    uint32_t n = PGSIZE / 64;
+
+    if (!string_sse2) {
+        memset(p, 0, PGSIZE);
+    } else if (!(read_eflags() & FL_IF)) {
+        asm volatile("pxor %%xmm0, %%xmm0\n"
+                     "1: movntdq %%xmm0, (%0)\n"
+                     "movntdq %%xmm0, 16(%0)\n"
+                     "movntdq %%xmm0, 32(%0)\n"
+                     "movntdq %%xmm0, 48(%0)\n"
+                     "add $64, %0\n"
+                     "decl %1\n"
+                     "jnz 1b\n"
+                     "sfence"
+                     : "+r" (p), "+r" (n) :: "cc", "memory" SSE2_CLOBBERS);
+    } else {
+        n = PGSIZE / 16;
+        asm volatile("1: movnti %2, (%0)\n"
+                     "movnti %2, 4(%0)\n"
+                     "movnti %2, 8(%0)\n"
+                     "movnti %2, 12(%0)\n"
+                     "add $16, %0\n"
+                     "decl %1\n"
+                     "jnz 1b\n"
+                     "sfence"
+                     : "+r" (p), "+r" (n) : "r" (0) : "cc", "memory");
+    }
+}
+
+void
+page_copy(struct PageInfo *dst, struct PageInfo *src) {
+    void *d = page2kva(dst);
+    const void *s = page2kva(src);
+    uint32_t n = PGSIZE / 64, tmp;
+
+    if (!string_sse2) {
+        memcpy(d, s, PGSIZE);
+    } else if (!(read_eflags() & FL_IF)) {
+        asm volatile("1: movdqa (%1), %%xmm0\n"
+                     "movdqa 16(%1), %%xmm1\n"
+                     "movdqa 32(%1), %%xmm2\n"
+                     "movdqa 48(%1), %%xmm3\n"
+                     "movntdq %%xmm0, (%0)\n"
+                     "movntdq %%xmm1, 16(%0)\n"
+                     "movntdq %%xmm2, 32(%0)\n"
+                     "movntdq %%xmm3, 48(%0)\n"
+                     "add $64, %0\n"
+                     "add $64, %1\n"
+                     "decl %2\n"
+                     "jnz 1b\n"
+                     "sfence"
+                     : "+r" (d), "+r" (s), "+r" (n)
+                     :: "cc", "memory" SSE2_CLOBBERS);
+    } else {
+        n = PGSIZE / 4;
+        asm volatile("1: movl (%1), %3\n"
+                     "movnti %3, (%0)\n"
+                     "add $4, %0\n"
+                     "add $4, %1\n"
+                     "decl %2\n"
+                     "jnz 1b\n"
+                     "sfence"
+                     : "+r" (d), "+r" (s), "+r" (n), "=&r" (tmp)
+                     :: "cc", "memory");
+    }
+}
+
 // Given 'pgdir', a pointer to a page directory, pgdir_walk returns
 // a pointer to the page table entry (PTE) for linear address 'va'.
 // This requires walking the two-level page table structure.
@@ -491,7 +625,8 @@ struct PageInfo *
 page_lookup(pde_t *pgdir, void *va, pte_t **pte_store) {
     // 只查找，所以create=0
     pte_t *pte = pgdir_walk(pgdir, va, 0);
-    if (!pte)
+    // 页表存在但页表项不存在时也没有映射
+    if (!pte || !(*pte & PTE_P))
         return NULL;
 
     if (pte_store) {
@@ -596,6 +731,8 @@ check_page_free_list(bool only_low_memory) {
         assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
         assert(page2pa(pp) != EXTPHYSMEM);
         assert(page2pa(pp) < EXTPHYSMEM || (char *) page2kva(pp) >= first_free_page);
+        assert(page2pa(pp) < CRASHDUMP_PADDR
+               || page2pa(pp) >= CRASHDUMP_PADDR + CRASHDUMP_SIZE);
 
         if (page2pa(pp) < EXTPHYSMEM)
             ++nfree_basemem;
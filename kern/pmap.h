@@ -57,11 +57,25 @@ void	mem_init(void);
 void	page_init(void);
 struct PageInfo *page_alloc(int alloc_flags);
 void	page_free(struct PageInfo *pp);
+void	page_zero(struct PageInfo *pp);
+void	page_copy(struct PageInfo *dst, struct PageInfo *src);
 int	page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm);
 void	page_remove(pde_t *pgdir, void *va);
 struct PageInfo *page_lookup(pde_t *pgdir, void *va, pte_t **pte_store);
 void	page_decref(struct PageInfo *pp);
 
+// page_free_list, as far as page_free_stats could follow it.
+struct PageFreeStats {
+	uint32_t pfs_nfree;		// pages on the list
+	uint32_t pfs_head;		// physical address of the first page
+	uint32_t pfs_lowest;		// and of the lowest and highest
+	uint32_t pfs_highest;
+	uint32_t pfs_corrupt;		// 1 if a link left 'pages', or the
+					// list was longer than 'npages'
+} __attribute__((packed));
+
+void	page_free_stats(struct PageFreeStats *stats);
+
 void	tlb_invalidate(pde_t *pgdir, void *va);
 
 static inline physaddr_t
@@ -1,25 +1,75 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on printfmt() and the kernel console's cons_write().
 
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
+#include <inc/string.h>
 
+#include <kern/console.h>
 
+
+// Each call collects its output in a printbuf and hands it to the
+// console a line at a time, so that every console device sees one bulk
+// write per line rather than a call per character.
+struct printbuf {
+	int idx;	// current buffer index
+	int cnt;	// total bytes printed so far
+	char buf[256];
+};
+
+static void
+putch(int ch, struct printbuf *b)
+{
+	b->buf[b->idx++] = ch;
+	b->cnt++;
+	if (ch == '\n' || b->idx == sizeof(b->buf)) {
+		cons_write(b->buf, b->idx);
+		b->idx = 0;
+	}
+}
+
+// Runs too long to buffer go straight to the console; anything else is
+// copied in, flushing at each newline just as putch does.
 static void
-putch(int ch, int *cnt)
+putstr(const char *s, size_t len, struct printbuf *b)
 {
-	cputchar(ch);
-	*cnt++;
+	const char *nl;
+	size_t n;
+
+	b->cnt += len;
+	if (len >= sizeof(b->buf)) {
+		cons_write(b->buf, b->idx);
+		cons_write(s, len);
+		b->idx = 0;
+		return;
+	}
+	while (len > 0) {
+		n = MIN(len, sizeof(b->buf) - b->idx);
+		if ((nl = memfind(s, '\n', n)) < s + n)
+			n = nl - s + 1;
+		memmove(b->buf + b->idx, s, n);
+		b->idx += n;
+		s += n;
+		len -= n;
+		if (b->buf[b->idx - 1] == '\n' || b->idx == sizeof(b->buf)) {
+			cons_write(b->buf, b->idx);
+			b->idx = 0;
+		}
+	}
 }
 
 int
 vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
+	struct printbuf b;
+	struct printer pr = { (void*)putch, (void*)putstr, &b };
 
-	vprintfmt((void*)putch, &cnt, fmt, ap);
-	return cnt;
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt_pr(&pr, fmt, ap);
+	cons_write(b.buf, b.idx);
+	return b.cnt;
 }
 
 int
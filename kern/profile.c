@@ -0,0 +1,264 @@
+// Statistical sampling profiler.
+//
+// While the profiler runs, the interval timer interrupts the kernel at
+// a fixed rate and profile_tick notes where it was: the interrupted eip
+// goes into a histogram, and the first few frames of the stack into a
+// table of distinct stacks.  Nothing is symbolized until someone asks
+// for a report.
+//
+// The kernel runs on a single CPU, so there is a single set of tables.
+// Only the timer interrupt writes them; readers turn interrupts off.
+//
+// The kernel normally runs with interrupts disabled, which would leave
+// nothing but the console's idle loop to sample, so the monitor runs
+// commands with interrupts enabled while the profiler is on.  Code that
+// checks (lib/string.c's SSE2 paths, for one) behaves accordingly.
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/trap.h>
+#include <inc/x86.h>
+
+#include <kern/profile.h>
+#include <kern/backtrace.h>
+#include <kern/kclock.h>
+#include <kern/kdebug.h>
+#include <kern/picirq.h>
+
+// Slots to try in a hash table before counting a sample as lost.
+#define PROFILE_PROBES	16
+
+struct ProfileStack {
+	uint32_t count;
+	uint32_t depth;
+	uintptr_t eips[PROFILE_DEPTH];
+};
+
+static struct {
+	bool running;
+	unsigned hz;
+	uint64_t start, stop;		// ktime_cycles() at start and stop
+	uint32_t samples;
+	uint32_t lost;			// eips with no room in hist
+	uint32_t stacks_lost;		// stacks with no room in stacks
+	struct {
+		uintptr_t eip;		// 0 if empty
+		uint32_t count;
+	} hist[PROFILE_NBUCKETS];
+	struct ProfileStack stacks[PROFILE_NSTACKS];
+} prof;
+
+static uint32_t
+hash(uint32_t h, uint32_t x)
+{
+	return (h ^ x) * 2654435761U;
+}
+
+unsigned
+profile_start(unsigned hz)
+{
+	uint32_t eflags;
+
+	if (!pic_inited)
+		return 0;
+
+	eflags = read_eflags();
+	asm volatile("cli");
+	memset(&prof, 0, sizeof(prof));
+	prof.hz = pit_setrate(hz ? hz : PROFILE_HZ);
+	prof.running = 1;
+	prof.start = ktime_cycles();
+	irq_writemask_8259A(irq_mask_8259A & ~(1 << IRQ_TIMER));
+	write_eflags(eflags);
+	return prof.hz;
+}
+
+void
+profile_stop(void)
+{
+	uint32_t eflags = read_eflags();
+
+	asm volatile("cli");
+	if (prof.running) {
+		irq_writemask_8259A(irq_mask_8259A | (1 << IRQ_TIMER));
+		prof.stop = ktime_cycles();
+	}
+	prof.running = 0;
+	write_eflags(eflags);
+}
+
+bool
+profile_running(void)
+{
+	return prof.running;
+}
+
+void
+profile_tick(struct Trapframe *tf)
+{
+	struct ProfileStack *s;
+	uintptr_t eips[PROFILE_DEPTH];
+	uint32_t h, depth;
+	int i;
+
+	if (!prof.running)
+		return;
+	prof.samples++;
+
+	h = hash(0, tf->tf_eip);
+	for (i = 0; i < PROFILE_PROBES; i++) {
+		uint32_t b = ((h >> 16) + i) % PROFILE_NBUCKETS;
+		if (prof.hist[b].eip == tf->tf_eip) {
+			prof.hist[b].count++;
+			break;
+		}
+		if (prof.hist[b].eip == 0) {
+			prof.hist[b].eip = tf->tf_eip;
+			prof.hist[b].count = 1;
+			break;
+		}
+	}
+	if (i == PROFILE_PROBES)
+		prof.lost++;
+
+	// The interrupted function's frame may not be set up yet (or any
+	// more), in which case the walk starts at its caller's caller.
+	eips[0] = tf->tf_eip;
+	depth = 1 + backtrace_capture(tf->tf_regs.reg_ebp, eips + 1,
+				      PROFILE_DEPTH - 1);
+	for (h = 0, i = 0; i < depth; i++)
+		h = hash(h, eips[i]);
+	for (i = 0; i < PROFILE_PROBES; i++) {
+		s = &prof.stacks[((h >> 16) + i) % PROFILE_NSTACKS];
+		if (s->count == 0) {
+			s->depth = depth;
+			memcpy(s->eips, eips, depth * sizeof(eips[0]));
+		} else if (s->depth != depth
+			   || memcmp(s->eips, eips, depth * sizeof(eips[0])) != 0)
+			continue;
+		s->count++;
+		break;
+	}
+	if (i == PROFILE_PROBES)
+		prof.stacks_lost++;
+}
+
+
+/***** Reports *****/
+
+// The function containing 'eip', or 'eip' itself if it has no symbol.
+static uintptr_t
+func_of(uintptr_t eip)
+{
+	struct Eipdebuginfo info;
+
+	if (backtrace_symbolize(eip, &info) < 0)
+		return eip;
+	return info.eip_fn_addr;
+}
+
+// Print the name of the function at 'addr' from func_of.
+static void
+print_func(uintptr_t addr)
+{
+	struct Eipdebuginfo info;
+
+	if (backtrace_symbolize(addr, &info) < 0 || info.eip_fn_addr != addr)
+		cprintf("%08x", addr);
+	else
+		cprintf("%.*s", info.eip_fn_namelen, info.eip_fn_name);
+}
+
+void
+profile_report(int n)
+{
+	static struct {
+		uintptr_t addr;
+		uint32_t count;
+	} funcs[PROFILE_NBUCKETS], t;
+	uint32_t eflags = read_eflags();
+	uintptr_t addr;
+	int i, j, nfuncs = 0;
+
+	asm volatile("cli");
+
+	// Sum the histogram by function.
+	for (i = 0; i < PROFILE_NBUCKETS; i++) {
+		if (prof.hist[i].eip == 0)
+			continue;
+		addr = func_of(prof.hist[i].eip);
+		for (j = 0; j < nfuncs && funcs[j].addr != addr; j++)
+			;
+		if (j == nfuncs) {
+			funcs[nfuncs].addr = addr;
+			funcs[nfuncs++].count = 0;
+		}
+		funcs[j].count += prof.hist[i].count;
+	}
+
+	// Most samples first.
+	for (i = 1; i < nfuncs; i++) {
+		t = funcs[i];
+		for (j = i; j > 0 && funcs[j - 1].count < t.count; j--)
+			funcs[j] = funcs[j - 1];
+		funcs[j] = t;
+	}
+
+	cprintf("profile: %u samples at %u Hz over %llu ms%s, %u lost, %u stacks lost\n",
+		prof.samples, prof.hz,
+		cycles_to_ns((prof.running ? ktime_cycles() : prof.stop)
+			     - prof.start) / 1000000,
+		prof.running ? " (running)" : "", prof.lost, prof.stacks_lost);
+	if (n <= 0 || n > nfuncs)
+		n = nfuncs;
+	for (i = 0; i < n; i++) {
+		uint32_t permille = prof.samples
+			? (uint64_t) funcs[i].count * 1000 / prof.samples : 0;
+		cprintf("  %7u %3u.%u%%  ", funcs[i].count,
+			permille / 10, permille % 10);
+		print_func(funcs[i].addr);
+		cprintf("\n");
+	}
+
+	write_eflags(eflags);
+}
+
+void
+profile_folded(void)
+{
+	static struct ProfileStack folded[PROFILE_NSTACKS], f;
+	uint32_t eflags = read_eflags();
+	int i, j, nfolded = 0;
+
+	asm volatile("cli");
+
+	// Replace each frame with its function, then merge the stacks
+	// that turn out the same.
+	for (i = 0; i < PROFILE_NSTACKS; i++) {
+		if (prof.stacks[i].count == 0)
+			continue;
+		f = prof.stacks[i];
+		for (j = 0; j < f.depth; j++)
+			f.eips[j] = func_of(f.eips[j]);
+		for (j = 0; j < nfolded; j++)
+			if (folded[j].depth == f.depth
+			    && memcmp(folded[j].eips, f.eips,
+				      f.depth * sizeof(f.eips[0])) == 0)
+				break;
+		if (j == nfolded)
+			folded[nfolded++] = f;
+		else
+			folded[j].count += f.count;
+	}
+
+	for (i = 0; i < nfolded; i++) {
+		for (j = folded[i].depth - 1; j >= 0; j--) {
+			print_func(folded[i].eips[j]);
+			if (j > 0)
+				cprintf(";");
+		}
+		cprintf(" %u\n", folded[i].count);
+	}
+
+	write_eflags(eflags);
+}
@@ -0,0 +1,40 @@
+#ifndef JOS_KERN_PROFILE_H
+#define JOS_KERN_PROFILE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct Trapframe;
+
+// Default sampling rate, in Hz.
+#define PROFILE_HZ		1000
+
+// Distinct sampled eips the histogram holds (a power of two).
+#define PROFILE_NBUCKETS	1024
+// Distinct stacks kept for the folded-stack export (a power of two),
+// and the frames kept per stack, innermost first.
+#define PROFILE_NSTACKS		256
+#define PROFILE_DEPTH		8
+
+// Start sampling 'hz' times a second (PROFILE_HZ if 0), discarding any
+// earlier samples.  Returns the actual rate.
+unsigned profile_start(unsigned hz);
+void profile_stop(void);
+bool profile_running(void);
+
+// Take one sample of the interrupted context; called on every timer
+// interrupt.
+void profile_tick(struct Trapframe *tf);
+
+// Print the 'n' functions with the most samples.
+void profile_report(int n);
+
+// Print the sampled stacks in folded form, one per line, outermost
+// frame first:
+//	i386_init;monitor;runcmd;mon_bench;...;memcpy 42
+// Pipe the lines through flamegraph.pl to draw a flame graph.
+void profile_folded(void);
+
+#endif	// !JOS_KERN_PROFILE_H
@@ -0,0 +1,159 @@
+// Binary kernel trace ring.
+//
+// trace() is meant for hot paths: it costs a timestamp, an atomic
+// increment and a few stores, where a cprintf spends its time waiting
+// on the serial port.  Records are formatted through vprintfmt only when
+// someone asks for them with the 'dmesg' monitor command.
+//
+// The kernel runs on a single CPU, so there is a single ring.  Slots are
+// claimed with an atomic increment, so tracepoints in interrupt handlers
+// can't collide with the code they interrupted.
+
+#include <inc/stdio.h>
+#include <inc/stdarg.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/trace.h>
+#include <kern/console.h>
+#include <kern/kclock.h>
+
+static struct {
+	volatile uint32_t head;		// records ever made; next slot
+	struct TraceRecord rec[TRACE_NRECORDS];
+} trace_ring;
+
+void
+trace(const char *fmt, ...)
+{
+	struct TraceRecord *r;
+	uint32_t slot = 1;
+	va_list ap;
+	int i;
+
+	asm volatile("lock; xaddl %0, %1"
+		     : "+r" (slot), "+m" (trace_ring.head) : : "cc");
+	r = &trace_ring.rec[slot % TRACE_NRECORDS];
+
+	r->tr_tsc = read_tsc();
+	r->tr_fmt = fmt;
+	r->tr_eip = (uintptr_t) __builtin_return_address(0);
+
+	// We don't know how many arguments there are, so copy the most
+	// we'll keep.  Any extra words just come from our caller's frame.
+	va_start(ap, fmt);
+	for (i = 0; i < TRACE_NARGS; i++)
+		r->tr_args[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+}
+
+void
+trace_dump(int n)
+{
+	uint32_t head = trace_ring.head, seq;
+	struct TraceRecord *r;
+	uint64_t t0;
+	size_t len;
+
+	if (n <= 0 || n > TRACE_NRECORDS)
+		n = TRACE_NRECORDS;
+	if (n > head)
+		n = head;
+	if (n == 0)
+		return;
+
+	t0 = trace_ring.rec[(head - n) % TRACE_NRECORDS].tr_tsc;
+	for (seq = head - n; seq != head; seq++) {
+		r = &trace_ring.rec[seq % TRACE_NRECORDS];
+		cprintf("[%6u +%12llu ns] %08x ", seq,
+			cycles_to_ns(r->tr_tsc - t0), r->tr_eip);
+		// On i386 a va_list is just a pointer to the argument
+		// words, which is exactly what we saved.
+		vcprintf(r->tr_fmt, (va_list) r->tr_args);
+		len = strlen(r->tr_fmt);
+		if (len == 0 || r->tr_fmt[len - 1] != '\n')
+			cprintf("\n");
+	}
+}
+
+int
+trace_copy(struct TraceRecord *out, int n, uint32_t *seq)
+{
+	uint32_t head = trace_ring.head, i;
+
+	if (n <= 0 || n > TRACE_NRECORDS)
+		n = TRACE_NRECORDS;
+	if (n > head)
+		n = head;
+	*seq = head - n;
+	for (i = 0; i < n; i++)
+		out[i] = trace_ring.rec[(*seq + i) % TRACE_NRECORDS];
+	return n;
+}
+
+
+/***** Streaming to COM2 *****/
+
+static struct {
+	bool on;
+	uint32_t seq;		// next record to send
+	uint32_t lost;		// records overwritten before we sent them
+} sink;
+
+static void
+trace_sink_send(int type, uint32_t seq, const struct TraceRecord *r)
+{
+	struct TraceFrame f;
+
+	f.fr_magic = TRACE_FRAME_MAGIC;
+	f.fr_type = type;
+	f.fr_nargs = TRACE_NARGS;
+	f.fr_seq = seq;
+	f.fr_tsc = r->tr_tsc;
+	f.fr_eip = r->tr_eip;
+	f.fr_fmt = (uintptr_t) r->tr_fmt;
+	memmove(f.fr_args, r->tr_args, sizeof(f.fr_args));
+	com2_write(&f, sizeof(f));
+}
+
+void
+trace_sink_init(void)
+{
+	struct TraceRecord hello;
+
+	if (!com2_init())
+		return;
+	sink.on = 1;
+
+	memset(&hello, 0, sizeof(hello));
+	hello.tr_tsc = read_tsc();
+	hello.tr_args[0] = ktime_calib.tsc_khz;
+	trace_sink_send(TRACE_FRAME_HELLO, trace_ring.head, &hello);
+}
+
+// Send up to n of the records made since the last drain that are still
+// in the ring, or all of them if n <= 0.  Returns how many are left.
+int
+trace_sink_drain(int n)
+{
+	uint32_t head = trace_ring.head;
+	int i;
+
+	if (!sink.on)
+		return 0;
+	if (head - sink.seq > TRACE_NRECORDS) {
+		sink.lost += head - TRACE_NRECORDS - sink.seq;
+		sink.seq = head - TRACE_NRECORDS;
+	}
+	for (i = 0; sink.seq != head && (n <= 0 || i < n); i++, sink.seq++)
+		trace_sink_send(TRACE_FRAME_RECORD, sink.seq,
+				&trace_ring.rec[sink.seq % TRACE_NRECORDS]);
+	return head - sink.seq;
+}
+
+// Number of records overwritten before the sink could send them.
+uint32_t
+trace_sink_lost(void)
+{
+	return sink.lost;
+}
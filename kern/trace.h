@@ -0,0 +1,71 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Number of records the trace ring holds (a power of two).
+#define TRACE_NRECORDS	1024
+// Argument words saved per record.
+#define TRACE_NARGS	6
+
+// One trace record.  Nothing is formatted when a record is made: the
+// format pointer and raw argument words are saved, and formatted later
+// when the ring is dumped.
+struct TraceRecord {
+	uint64_t tr_tsc;		// read_tsc() at the tracepoint
+	const char *tr_fmt;		// printf format (a string constant)
+	uintptr_t tr_eip;		// address the tracepoint returns to
+	uint32_t tr_args[TRACE_NARGS];	// raw argument words
+};
+
+// Record a tracepoint.  'fmt' is a cprintf format taking at most
+// TRACE_NARGS words of arguments.  Since formatting happens later, 'fmt'
+// must be a string constant and %s arguments must outlive the record.
+void trace(const char *fmt, ...);
+
+// Print the last 'n' records (all of them if n <= 0), oldest first.
+void trace_dump(int n);
+
+// Copy the last 'n' records (all of them if n <= 0) to 'out', oldest
+// first.  Returns the number copied, and stores the sequence number of
+// the first in '*seq'.
+int trace_copy(struct TraceRecord *out, int n, uint32_t *seq);
+
+// The trace sink streams records out of COM2 as TraceFrames, for
+// ./trace-decode on the host.  QEMU writes COM2 to obj/kern/trace.bin.
+// Records are sent when the kernel goes idle or panics, so streaming
+// costs the traced code nothing; records overwritten before they could
+// be sent show up as gaps in the sequence numbers.  At idle the sink
+// sends only TRACE_SINK_BATCH records between checks for input, since
+// each frame takes about 4ms on a real 115200-baud UART.
+
+#define TRACE_FRAME_MAGIC	0x5254	// "TR"
+#define TRACE_SINK_BATCH	2	// records per idle pass
+
+enum {
+	TRACE_FRAME_HELLO = 1,		// the sink started: fr_tsc is now,
+					// fr_args[0] the TSC rate in kHz
+					// (0 if unknown)
+	TRACE_FRAME_RECORD,		// one TraceRecord, number fr_seq
+};
+
+// All fields are little-endian.
+struct TraceFrame {
+	uint16_t fr_magic;		// TRACE_FRAME_MAGIC
+	uint8_t fr_type;		// TRACE_FRAME_*
+	uint8_t fr_nargs;		// TRACE_NARGS
+	uint32_t fr_seq;		// record sequence number
+	uint64_t fr_tsc;
+	uint32_t fr_eip;
+	uint32_t fr_fmt;		// kernel address of the format
+	uint32_t fr_args[TRACE_NARGS];
+} __attribute__((packed));
+
+void trace_sink_init(void);
+int trace_sink_drain(int n);
+uint32_t trace_sink_lost(void);
+
+#endif	// !JOS_KERN_TRACE_H
@@ -28,25 +28,104 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 };
 
+static const char digits[] = "0123456789abcdef";
+
+// "00" "01" ... "99", so that decimal conversion can produce
+// two digits per division.
+static const char digits2[200] =
+	"00010203040506070809" "10111213141516171819"
+	"20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
+// Write the decimal digits of 'n' backwards, ending just before 'p',
+// and return a pointer to the first digit.  If 'ndigits' is nonzero,
+// zero-fill to exactly that many digits.
+static char *
+fmt_dec32(char *p, uint32_t n, int ndigits)
+{
+	char *end = p;
+	unsigned r;
+
+	while (n >= 100) {
+		r = n % 100;
+		n /= 100;
+		p -= 2;
+		p[0] = digits2[2 * r];
+		p[1] = digits2[2 * r + 1];
+	}
+	if (n >= 10) {
+		p -= 2;
+		p[0] = digits2[2 * n];
+		p[1] = digits2[2 * n + 1];
+	} else
+		*--p = digits[n];
+	while (end - p < ndigits)
+		*--p = '0';
+	return p;
+}
+
+// Emit the 'len' bytes at 's' in one putstr call if the printer has
+// one, and a character at a time otherwise.
+static void
+putstr(const struct printer *pr, const char *s, size_t len)
+{
+	if (pr->putstr)
+		pr->putstr(s, len, pr->putdat);
+	else
+		while (len-- > 0)
+			pr->putch(*s++, pr->putdat);
+}
+
 /*
- * Print a number (base <= 16) in reverse order,
- * using specified putch function and associated pointer putdat.
+ * Print a number (base <= 16) using the specified printer.
+ *
+ * The digits are generated backwards into a local buffer.  Power-of-two
+ * bases are done with shifts and masks; everything else does its
+ * division in 32 bits, so that only values that really need 64 bits
+ * pay for libgcc's __udivdi3 and __umoddi3.
  */
 static void
-printnum(void (*putch)(int, void*), void *putdat,
+printnum(const struct printer *pr,
 	 unsigned long long num, unsigned base, int width, int padc)
 {
-	// first recursively print all preceding (more significant) digits
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
+	char buf[64];		// 64 bits in binary
+	char *end = buf + sizeof(buf), *p = end;
+	unsigned shift, mask;
+	uint32_t n;
+
+	if ((base & (base - 1)) == 0) {
+		for (shift = 0; (1U << shift) < base; shift++)
+			/* do nothing */;
+		mask = base - 1;
+		do {
+			*--p = digits[(uint32_t) num & mask];
+			num >>= shift;
+		} while (num);
+	} else if (base == 10) {
+		// Peel off nine digits at a time until the rest fits
+		while (num > 0xFFFFFFFFULL) {
+			p = fmt_dec32(p, num % 1000000000, 9);
+			num /= 1000000000;
+		}
+		p = fmt_dec32(p, num, 0);
 	} else {
-		// print any needed pad characters before first digit
-		while (--width > 0)
-			putch(padc, putdat);
+		while (num > 0xFFFFFFFFULL) {
+			*--p = digits[num % base];
+			num /= base;
+		}
+		n = num;
+		do {
+			*--p = digits[n % base];
+			n /= base;
+		} while (n);
 	}
 
-	// then print this (the least significant) digit
-	putch("0123456789abcdef"[num % base], putdat);
+	// print any needed pad characters before first digit
+	for (width -= end - p; width > 0; width--)
+		pr->putch(padc, pr->putdat);
+	putstr(pr, p, end - p);
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -81,18 +160,39 @@ void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 
 void
 vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+{
+	struct printer pr = { putch, NULL, putdat };
+
+	vprintfmt_pr(&pr, fmt, ap);
+}
+
+// Like vprintfmt, but literal text and %s arguments are handed to
+// pr->putstr a run at a time when the printer provides it.
+void
+vprintfmt_pr(const struct printer *pr, const char *fmt, va_list args)
 {
 	register const char *p;
 	register int ch, err;
 	unsigned long long num;
 	int base, lflag, width, precision, altflag;
+	int len;
 	char padc;
+	void (*putch)(int, void*) = pr->putch;
+	void *putdat = pr->putdat;
+	va_list ap;
 
+	// getint and getuint take a pointer to the va_list, which isn't
+	// the same thing as &args where va_list is an array type (as it
+	// is for a native x86-64 build), so work on a copy.
+	va_copy(ap, args);
 	while (1) {
-		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
-				return;
-			putch(ch, putdat);
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		if (fmt > p)
+			putstr(pr, p, fmt - p);
+		if (*fmt++ == '\0') {
+			va_end(ap);
+			return;
 		}
 
 		// Process a %-escape sequence
@@ -165,24 +265,31 @@ vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
 			err = va_arg(ap, int);
 			if (err < 0)
 				err = -err;
-			if (err >= MAXERROR || (p = error_string[err]) == NULL)
-				printfmt(putch, putdat, "error %d", err);
-			else
-				printfmt(putch, putdat, "%s", p);
+			if (err >= MAXERROR || (p = error_string[err]) == NULL) {
+				putstr(pr, "error ", 6);
+				printnum(pr, err, 10, -1, ' ');
+			} else
+				putstr(pr, p, strlen(p));
 			break;
 
 		// string
 		case 's':
 			if ((p = va_arg(ap, char *)) == NULL)
 				p = "(null)";
+			len = strnlen(p, precision);
 			if (width > 0 && padc != '-')
-				for (width -= strnlen(p, precision); width > 0; width--)
+				for (; width > len; width--)
 					putch(padc, putdat);
-			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
-				if (altflag && (ch < ' ' || ch > '~'))
-					putch('?', putdat);
-				else
-					putch(ch, putdat);
+			if (altflag) {
+				for (; len > 0; len--, width--)
+					if ((ch = *p++) < ' ' || ch > '~')
+						putch('?', putdat);
+					else
+						putch(ch, putdat);
+			} else {
+				putstr(pr, p, len);
+				width -= len;
+			}
 			for (; width > 0; width--)
 				putch(' ', putdat);
 			break;
@@ -225,7 +332,7 @@ vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
 			num = getuint(&ap, lflag);
 			base = 16;
 		number:
-			printnum(putch, putdat, num, base, width, padc);
+			printnum(pr, num, base, width, padc);
 			break;
 
 		// escaped '%' character
@@ -267,16 +374,29 @@ sprintputch(int ch, struct sprintbuf *b)
 		*b->buf++ = ch;
 }
 
+static void
+sprintputstr(const char *s, size_t len, struct sprintbuf *b)
+{
+	size_t n = len;
+
+	b->cnt += len;
+	if (n > b->ebuf - b->buf)
+		n = b->ebuf - b->buf;
+	memmove(b->buf, s, n);
+	b->buf += n;
+}
+
 int
 vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 {
 	struct sprintbuf b = {buf, buf+n-1, 0};
+	struct printer pr = {(void*)sprintputch, (void*)sprintputstr, &b};
 
 	if (buf == NULL || n < 1)
 		return -E_INVAL;
 
 	// print the string to the buffer
-	vprintfmt((void*)sprintputch, &b, fmt, ap);
+	vprintfmt_pr(&pr, fmt, ap);
 
 	// null terminate the buffer
 	*b.buf = '\0';
@@ -1,21 +1,49 @@
 // Basic string routines.  Not hardware optimized, but not shabby.
 
 #include <inc/string.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
 // but it makes an even bigger difference on bochs.
 // Primespipe runs 3x faster this way.
-#define ASM 1
+// Build with -DSTRING_ASM=0 to get the plain byte-at-a-time versions.
+#ifndef STRING_ASM
+#define STRING_ASM 1
+#endif
+#define ASM STRING_ASM
+
+// Set once SSE has been enabled on a CPU with SSE2; memset and
+// memcpy then move 64-byte blocks through %xmm0-3.  Clear it to
+// compare against the dword bodies.  It lives in .data, not .bss: the
+// kernel's first memset is the one that clears the BSS, and must not
+// find a stray nonzero flag there before SSE is enabled.
+bool string_sse2 __attribute__((section(".data")));
+
+// Word-at-a-time helpers.  HASZERO(w) is nonzero iff some byte of w
+// is zero; aligned word loads never cross into the next page, so they
+// are safe to use past a string's terminating null.
+typedef uint32_t __attribute__((may_alias)) word_t;
+#define ONES		0x01010101U
+#define HIGHS		0x80808080U
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+#define ALIGNED(p)	(((uintptr_t) (p) & (sizeof(word_t) - 1)) == 0)
 
 int
 strlen(const char *s)
 {
-	int n;
+	const char *p = s;
+	const word_t *w;
 
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	for (; !ALIGNED(p); p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; !HASZERO(*w); w++)
+		/* do nothing */;
+	for (p = (const char *) w; *p != '\0'; p++)
+		/* do nothing */;
+	return p - s;
 }
 
 int
@@ -79,6 +107,22 @@ strlcpy(char *dst, const char *src, size_t size)
 int
 strcmp(const char *p, const char *q)
 {
+	const word_t *wp, *wq;
+
+	// If both strings can be word-aligned together, compare a word at
+	// a time until the words differ or hold the terminator.
+	if (ALIGNED((uintptr_t) p ^ (uintptr_t) q)) {
+		for (; !ALIGNED(p); p++, q++)
+			if (*p == '\0' || *p != *q)
+				goto bytes;
+		wp = (const word_t *) p;
+		wq = (const word_t *) q;
+		for (; *wp == *wq && !HASZERO(*wp); wp++, wq++)
+			/* do nothing */;
+		p = (const char *) wp;
+		q = (const char *) wq;
+	}
+bytes:
 	while (*p && *p == *q)
 		p++, q++;
 	return (int) ((unsigned char) *p - (unsigned char) *q);
@@ -118,53 +162,151 @@ strfind(const char *s, char c)
 }
 
 #if ASM
+// SSE2 bodies only pay off for larger blocks, and are only used with
+// interrupts disabled: the kernel doesn't save %xmm registers across
+// traps, so a handler that copied memory mid-copy would corrupt it.
+// The asm declares the registers with SSE2_CLOBBERS (inc/string.h).
+#define SSE2_MIN	128
+
+static bool
+use_sse2(size_t n)
+{
+#ifdef JOS_KERNEL
+	return string_sse2 && n >= SSE2_MIN && !(read_eflags() & FL_IF);
+#else
+	// Only the kernel (and the host test harness) set string_sse2
+	return string_sse2 && n >= SSE2_MIN;
+#endif
+}
+
 void *
 memset(void *v, int c, size_t n)
 {
-	char *p;
-
-	if (n == 0)
-		return v;
-	if ((int)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
-			: "cc", "memory");
-	} else
-		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
-			: "cc", "memory");
+	char *p = v;
+	uint32_t w, head, body;
+	bool sse;
+
+	c &= 0xFF;
+	w = c * ONES;
+	if (n >= 16) {
+		// Head: align p to the body's stride
+		sse = use_sse2(n);
+		head = -(uintptr_t) p & (sse ? 15 : 3);
+		n -= head;
+		asm volatile("rep stosb"
+			: "+D" (p), "+c" (head) : "a" (c) : "cc", "memory");
+
+		// Body: 64-byte blocks, then dwords
+		if (sse) {
+			body = n & ~63;
+			n -= body;
+			asm volatile("movd %2, %%xmm0\n"
+				"pshufd $0, %%xmm0, %%xmm0\n"
+				"1: movdqa %%xmm0, (%0)\n"
+				"movdqa %%xmm0, 16(%0)\n"
+				"movdqa %%xmm0, 32(%0)\n"
+				"movdqa %%xmm0, 48(%0)\n"
+				"add $64, %0\n"
+				"subl $64, %1\n"
+				"jnz 1b"
+				: "+r" (p), "+r" (body) : "r" (w)
+				: "cc", "memory" SSE2_CLOBBERS);
+		}
+		body = n / 4;
+		n &= 3;
+		asm volatile("rep stosl"
+			: "+D" (p), "+c" (body) : "a" (w) : "cc", "memory");
+	}
+	// Tail
+	asm volatile("rep stosb"
+		: "+D" (p), "+c" (n) : "a" (c) : "cc", "memory");
 	return v;
 }
 
+// Copy forwards, aligning the destination.  Safe for overlapping
+// buffers only if dst < src, which memmove relies on.
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	char *d = dst;
+	const char *s = src;
+	uint32_t head, body;
+	bool sse;
+
+	if (n >= 16) {
+		sse = use_sse2(n);
+		head = -(uintptr_t) d & (sse ? 15 : 3);
+		n -= head;
+		asm volatile("rep movsb"
+			: "+D" (d), "+S" (s), "+c" (head) :: "cc", "memory");
+
+		// Each 16 bytes is loaded before it is stored, so this
+		// works for dst < src however close they are.
+		if (sse) {
+			body = n & ~63;
+			n -= body;
+			asm volatile("1: movdqu (%1), %%xmm0\n"
+				"movdqa %%xmm0, (%0)\n"
+				"movdqu 16(%1), %%xmm1\n"
+				"movdqa %%xmm1, 16(%0)\n"
+				"movdqu 32(%1), %%xmm2\n"
+				"movdqa %%xmm2, 32(%0)\n"
+				"movdqu 48(%1), %%xmm3\n"
+				"movdqa %%xmm3, 48(%0)\n"
+				"add $64, %0\n"
+				"add $64, %1\n"
+				"subl $64, %2\n"
+				"jnz 1b"
+				: "+r" (d), "+r" (s), "+r" (body)
+				:: "cc", "memory" SSE2_CLOBBERS);
+		}
+		body = n / 4;
+		n &= 3;
+		asm volatile("rep movsl"
+			: "+D" (d), "+S" (s), "+c" (body) :: "cc", "memory");
+	}
+	asm volatile("rep movsb"
+		: "+D" (d), "+S" (s), "+c" (n) :: "cc", "memory");
+	return dst;
+}
+
+// Copy 'n' 'size'-byte units backwards, ending just below 'd' and 's'.
+// Some versions of GCC rely on DF being clear, so set it back.
+#define RMOVS(insn, size, d, s, n)					\
+	do {								\
+		char *__d = (d) - (size);				\
+		const char *__s = (s) - (size);				\
+		size_t __n = (n);					\
+		asm volatile("std; " insn "; cld"			\
+			: "+D" (__d), "+S" (__s), "+c" (__n)		\
+			:: "cc", "memory");				\
+	} while (0)
+
 void *
 memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
+	size_t tail;
 
 	s = src;
 	d = dst;
-	if (s < d && s + n > d) {
-		s += n;
-		d += n;
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
-		// Some versions of GCC rely on DF being clear
-		asm volatile("cld" ::: "cc");
-	} else {
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
-	}
+	if (!(s < d && s + n > d))
+		return memcpy(dst, src, n);
+
+	// Overlapping with dst above src: copy backwards, first aligning
+	// the end of the destination.
+	s += n;
+	d += n;
+	tail = n >= 16 ? (uintptr_t) d & 3 : n;
+	RMOVS("rep movsb", 1, d, s, tail);
+	d -= tail;
+	s -= tail;
+	n -= tail;
+	RMOVS("rep movsl", 4, d, s, n / 4);
+	d -= n & ~3;
+	s -= n & ~3;
+	RMOVS("rep movsb", 1, d, s, n & 3);
 	return dst;
 }
 
@@ -184,6 +326,17 @@ memset(void *v, int c, size_t n)
 	return v;
 }
 
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+
+	while (n-- > 0)
+		*d++ = *s++;
+	return dst;
+}
+
 void *
 memmove(void *dst, const void *src, size_t n)
 {
@@ -205,18 +358,21 @@ memmove(void *dst, const void *src, size_t n)
 }
 #endif
 
-void *
-memcpy(void *dst, const void *src, size_t n)
-{
-	return memmove(dst, src, n);
-}
-
 int
 memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
 
+	// Skip equal words; x86 doesn't mind unaligned loads, and these
+	// stay within the buffers.
+	for (; n >= sizeof(word_t); n -= sizeof(word_t)) {
+		if (*(const word_t *) s1 != *(const word_t *) s2)
+			break;
+		s1 += sizeof(word_t);
+		s2 += sizeof(word_t);
+	}
+
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
@@ -229,11 +385,20 @@ memcmp(const void *v1, const void *v2, size_t n)
 void *
 memfind(const void *s, int c, size_t n)
 {
-	const void *ends = (const char *) s + n;
-	for (; s < ends; s++)
-		if (*(const unsigned char *) s == (unsigned char) c)
+	const unsigned char *p = s, *ends = p + n;
+	const word_t *w;
+	uint32_t cc = (unsigned char) c * ONES;
+
+	for (; p < ends && !ALIGNED(p); p++)
+		if (*p == (unsigned char) c)
+			return (void *) p;
+	for (w = (const word_t *) p; (const unsigned char *) (w + 1) <= ends; w++)
+		if (HASZERO(*w ^ cc))
+			break;
+	for (p = (const unsigned char *) w; p < ends; p++)
+		if (*p == (unsigned char) c)
 			break;
-	return (void *) s;
+	return (void *) p;
 }
 
 long
@@ -0,0 +1,453 @@
+// Native test harness for lib/string.c and lib/printfmt.c.
+//
+//	libc fuzz [iterations]	compare JOS's routines against the host's
+//	libc bench		compare their throughput
+//
+// test/Makefrag compiles the JOS sources for the host with every
+// symbol renamed to jos_*, so both versions can live in this program.
+// Fuzzing runs twice, with and without the SSE2 bodies in lib/string.c.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+
+// JOS's size_t is 32 bits, even in a 64-bit build.
+typedef uint32_t jos_size_t;
+
+int	jos_strlen(const char *s);
+int	jos_strnlen(const char *s, jos_size_t size);
+int	jos_strcmp(const char *p, const char *q);
+int	jos_strncmp(const char *p, const char *q, jos_size_t n);
+char *	jos_strchr(const char *s, char c);
+void *	jos_memset(void *v, int c, jos_size_t n);
+void *	jos_memcpy(void *dst, const void *src, jos_size_t n);
+void *	jos_memmove(void *dst, const void *src, jos_size_t n);
+int	jos_memcmp(const void *v1, const void *v2, jos_size_t n);
+void *	jos_memfind(const void *s, int c, jos_size_t n);
+long	jos_strtol(const char *s, char **endptr, int base);
+int	jos_snprintf(char *buf, int n, const char *fmt, ...);
+extern _Bool jos_string_sse2;
+
+static unsigned long failures;
+
+static void
+fail(const char *what, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "FAIL %s: ", what);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	if (++failures >= 20) {
+		fprintf(stderr, "too many failures\n");
+		exit(1);
+	}
+}
+
+static int
+sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+// Mostly short lengths, where the head and tail handling lives, with
+// the occasional long one to exercise the bodies.
+static size_t
+rand_len(size_t max)
+{
+	size_t n = random() % 8 == 0 ? random() % max : random() % 80;
+
+	return n < max ? n : max - 1;
+}
+
+
+/***** Memory and strings *****/
+
+#define MEMSZ	8192
+#define SLACK	64
+
+static unsigned char ref[MEMSZ], jos[MEMSZ], src[MEMSZ];
+
+static void
+fill_random(unsigned char *p, size_t n)
+{
+	while (n-- > 0)
+		*p++ = random();
+}
+
+static void
+check_same(const char *what, size_t off, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < MEMSZ; i++)
+		if (ref[i] != jos[i]) {
+			fail(what, "off=%zu n=%zu: byte %zu is %02x, want %02x",
+			     off, n, i, jos[i], ref[i]);
+			return;
+		}
+}
+
+static void
+fuzz_mem(void)
+{
+	size_t n, a, b;
+	int c, r, j;
+	const char *p;
+
+	fill_random(src, MEMSZ);
+	fill_random(ref, MEMSZ);
+	memcpy(jos, ref, MEMSZ);
+	n = rand_len(MEMSZ - 2 * SLACK);
+	a = random() % SLACK;
+	b = random() % SLACK;
+
+	// memcpy, between buffers
+	memcpy(ref + b, src + a, n);
+	jos_memcpy(jos + b, src + a, n);
+	check_same("memcpy", b, n);
+
+	// memset
+	c = random();
+	memset(ref + a, c, n);
+	jos_memset(jos + a, c, n);
+	check_same("memset", a, n);
+
+	// memmove, overlapping in either direction
+	a = random() % (2 * SLACK);
+	b = random() % (2 * SLACK);
+	memmove(ref + b, ref + a, n);
+	jos_memmove(jos + b, jos + a, n);
+	check_same("memmove", b, n);
+
+	// memcmp, of equal buffers and of buffers that differ somewhere
+	memcpy(ref, src + a, n);
+	if (n > 0 && random() % 2)
+		ref[random() % n] ^= 1 + random() % 255;
+	r = memcmp(src + a, ref, n);
+	j = jos_memcmp(src + a, ref, n);
+	if (sign(r) != sign(j))
+		fail("memcmp", "n=%zu: %d, want %d", n, j, r);
+
+	// memfind, JOS's memchr, which returns the end rather than NULL
+	c = n > 0 && random() % 4 ? src[a + random() % n] : random();
+	p = memchr(src + a, c, n);
+	if (!p)
+		p = (const char *) src + a + n;
+	if (jos_memfind(src + a, c, n) != p)
+		fail("memfind", "n=%zu c=%02x: wrong match", n, c & 0xff);
+
+	// strlen, strnlen and strchr of a string starting anywhere
+	for (b = 0; b < n; b++)
+		if (ref[b] == 0)
+			ref[b] = 1 + random() % 255;
+	ref[n] = 0;
+	a = random() % SLACK;
+	memmove(ref + a, ref, n + 1);
+	if ((size_t) jos_strlen((char *) ref + a) != n)
+		fail("strlen", "n=%zu: %d", n, jos_strlen((char *) ref + a));
+	b = random() % (n + 2);
+	if ((size_t) jos_strnlen((char *) ref + a, b) != strnlen((char *) ref + a, b))
+		fail("strnlen", "n=%zu size=%zu", n, b);
+	c = n > 0 && random() % 2 ? ref[a + random() % n] : 1 + random() % 255;
+	if (jos_strchr((char *) ref + a, c) != strchr((char *) ref + a, c))
+		fail("strchr", "n=%zu c=%02x", n, c & 0xff);
+
+	// strcmp and strncmp against a copy at another alignment, maybe
+	// changed or cut short
+	b = random() % SLACK;
+	memcpy(jos + b, ref + a, n + 1);
+	if (n > 0 && random() % 2)
+		jos[b + random() % n] = random();
+	r = strcmp((char *) ref + a, (char *) jos + b);
+	j = jos_strcmp((char *) ref + a, (char *) jos + b);
+	if (sign(r) != sign(j))
+		fail("strcmp", "n=%zu: %d, want %d", n, j, r);
+	c = random() % (n + 2);
+	r = strncmp((char *) ref + a, (char *) jos + b, c);
+	j = jos_strncmp((char *) ref + a, (char *) jos + b, c);
+	if (sign(r) != sign(j))
+		fail("strncmp", "n=%zu size=%d: %d, want %d", n, c, j, r);
+}
+
+
+/***** strtol *****/
+
+// JOS's strtol skips only spaces and tabs, recognizes only a lowercase
+// "0x", and doesn't detect overflow, so only generate input where it
+// should agree with the host's.
+static void
+fuzz_strtol(void)
+{
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWYZ";
+	static const char junk[] = " +-.zZ";
+	static const int bases[] = { 0, 2, 8, 10, 16, 36 };
+	char buf[64], *p = buf, *rend, *jend;
+	int base = bases[random() % 6], maxdig, i, n;
+	long r, j;
+
+	while (random() % 3 == 0)
+		*p++ = random() % 2 ? ' ' : '\t';
+	if (random() % 3 == 0)
+		*p++ = random() % 2 ? '+' : '-';
+	maxdig = base == 0 ? 10 : base;
+	if ((base == 0 || base == 16) && random() % 3 == 0) {
+		*p++ = '0';
+		*p++ = 'x';
+		*p++ = digits[random() % 16];
+		maxdig = 16;
+	} else if (base == 0 && random() % 3 == 0) {
+		*p++ = '0';
+		maxdig = 8;
+	}
+
+	// Few enough digits not to overflow a 64-bit long
+	n = random() % (maxdig <= 16 ? 12 : 10);
+	for (i = 0; i < n; i++)
+		*p++ = digits[random() % maxdig];
+	// Then maybe some junk
+	for (n = random() % 3; n > 0; n--)
+		*p++ = junk[random() % (sizeof(junk) - 1)];
+	*p = 0;
+
+	r = strtol(buf, &rend, base);
+	j = jos_strtol(buf, &jend, base);
+	// When nothing converts the host puts endptr back at the start
+	// of the string, where JOS leaves it after the sign.
+	if (r != j || (rend != buf && rend != jend))
+		fail("strtol", "\"%s\" base %d: %ld end %td, want %ld end %td",
+		     buf, base, j, jend - buf, r, rend - buf);
+}
+
+
+/***** snprintf *****/
+
+// Append a random flag and width to 'p', from those where JOS and the
+// host agree: a zero flag and width for unsigned numbers, and a '-'
+// flag, width and precision for strings.  JOS reads a '0' straight
+// after the '.' as the zero flag, so precisions start at 1.  JOS puts
+// a negative %d's sign before the whole padded field, so signed
+// conversions get no width.
+static char *
+rand_spec(char *p, const char *conv, int string)
+{
+	*p++ = '%';
+	if (conv[strlen(conv) - 1] == 'd') {
+		// No flags or width
+	} else if (string) {
+		if (random() % 3 == 0)
+			*p++ = '-';
+		if (random() % 2)
+			p += sprintf(p, "%ld", random() % 20);
+		if (random() % 3 == 0)
+			p += sprintf(p, ".%ld", 1 + random() % 20);
+	} else {
+		if (random() % 3 == 0)
+			*p++ = '0';
+		if (random() % 2)
+			p += sprintf(p, "%ld", 1 + random() % 24);
+	}
+	return p + sprintf(p, "%s", conv);
+}
+
+static long long
+rand_value(void)
+{
+	long long v = (long long) random() << 33 ^ (long long) random() << 10 ^ random();
+
+	return v >> (random() % 64);
+}
+
+static void
+fuzz_snprintf(void)
+{
+	static const char *literals[] = { "", "x", "%%", " = ", "hello, world " };
+	static const char *iconv[] = { "d", "u", "x" };
+	static const char *llconv[] = { "lld", "llu", "llx" };
+	char fmt[256], str[32], rbuf[512], jbuf[512], *p = fmt;
+	int i, n, r, j, ival, ch;
+	long long llval;
+
+	// The arguments are always an int, a string, a long long, a
+	// char and an int, in that order; only their formatting varies.
+	ival = rand_value();
+	llval = rand_value();
+	ch = ' ' + random() % 95;
+	for (i = 0, n = random() % 24; i < n; i++)
+		str[i] = ' ' + random() % 95;
+	str[n] = 0;
+
+	p += sprintf(p, "%s", literals[random() % 5]);
+	p = rand_spec(p, iconv[random() % 3], 0);
+	p += sprintf(p, "%s", literals[random() % 5]);
+	p = rand_spec(p, "s", 1);
+	p += sprintf(p, "%s", literals[random() % 5]);
+	p = rand_spec(p, llconv[random() % 3], 0);
+	p += sprintf(p, "%s%%c", literals[random() % 5]);
+	p = rand_spec(p, iconv[random() % 3], 0);
+	p += sprintf(p, "%s", literals[random() % 5]);
+
+	// Usually big enough, sometimes truncated
+	n = 1 + (random() % 4 ? 256 : random() % 64);
+	memset(rbuf, 0x55, sizeof(rbuf));
+	memset(jbuf, 0x55, sizeof(jbuf));
+	r = snprintf(rbuf, n, fmt, ival, str, llval, ch, -ival);
+	j = jos_snprintf(jbuf, n, fmt, ival, str, llval, ch, -ival);
+	if (r != j || memcmp(rbuf, jbuf, sizeof(rbuf)) != 0)
+		fail("snprintf", "\"%s\" size %d: %d \"%s\", want %d \"%s\"",
+		     fmt, n, j, jbuf, r, rbuf);
+}
+
+static void
+fuzz(long iters)
+{
+	long i;
+	int sse2;
+
+	for (sse2 = 0; sse2 <= 1; sse2++) {
+		jos_string_sse2 = sse2;
+		srandom(1);
+		for (i = 0; i < iters; i++) {
+			fuzz_mem();
+			fuzz_strtol();
+			fuzz_snprintf();
+		}
+	}
+	printf("libc fuzz: iterations=%ld failures=%lu\n", iters, failures);
+	exit(failures ? 1 : 0);
+}
+
+
+/***** Benchmarks *****/
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define BENCH_BYTES	(32 << 20)
+
+// Keep the compiler from optimizing away the host's calls
+static volatile uintptr_t sink;
+
+enum { B_MEMCPY, B_MEMMOVE, B_MEMSET, B_MEMCMP, B_STRLEN, B_NFUNC };
+static const char *bench_names[] = {
+	"memcpy", "memmove", "memset", "memcmp", "strlen"
+};
+
+// Run 'func' over 'size' bytes, 'align' bytes off alignment, for about
+// 'total' bytes, and return the rate in MB/s.
+static double
+bench_one(int func, int use_jos, size_t size, size_t align, size_t total)
+{
+	static unsigned char a[65536 + SLACK], b[65536 + SLACK];
+	unsigned char *s = a + align, *d = b;
+	size_t i, n = total / size;
+	double start;
+
+	memset(a, 'x', sizeof(a));
+	memset(b, 'x', sizeof(b));
+	s[size - 1] = 0;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		switch (func) {
+		case B_MEMCPY:
+			sink += (uintptr_t) (use_jos ? jos_memcpy(d, s, size)
+					     : memcpy(d, s, size));
+			break;
+		case B_MEMMOVE:
+			sink += (uintptr_t) (use_jos ? jos_memmove(d + align + 1, d, size)
+					     : memmove(d + align + 1, d, size));
+			break;
+		case B_MEMSET:
+			sink += (uintptr_t) (use_jos ? jos_memset(d + align, i, size)
+					     : memset(d + align, i, size));
+			break;
+		case B_MEMCMP:
+			sink += use_jos ? jos_memcmp(d, s, size) : memcmp(d, s, size);
+			break;
+		case B_STRLEN:
+			sink += use_jos ? jos_strlen((char *) s) : strlen((char *) s);
+			break;
+		}
+	return n * size / (now() - start) / 1e6;
+}
+
+// Time 'fmt' applied to a spread of unsigned values, or to a string
+// if 'fmt' is "%s".
+static void
+bench_fmt(const char *fmt)
+{
+	static const char str[] = "the quick brown fox";
+	char buf[64];
+	double start, host, jos;
+	int i, n = 2000000, string = strcmp(fmt, "%s") == 0;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		if (string)
+			sink += snprintf(buf, sizeof(buf), fmt, str);
+		else
+			sink += snprintf(buf, sizeof(buf), fmt, i * 2654435761U);
+	host = n / (now() - start) / 1e6;
+	start = now();
+	for (i = 0; i < n; i++)
+		if (string)
+			sink += jos_snprintf(buf, sizeof(buf), fmt, str);
+		else
+			sink += jos_snprintf(buf, sizeof(buf), fmt, i * 2654435761U);
+	jos = n / (now() - start) / 1e6;
+	printf("libc bench: func=snprintf format=%s host=%.2fMcalls/s jos=%.2fMcalls/s\n",
+	       fmt, host, jos);
+}
+
+static void
+bench(void)
+{
+	static const size_t sizes[] = { 8, 64, 512, 4096, 65536 };
+	static const size_t aligns[] = { 0, 1, 3 };
+	double host, jos, jos_sse2;
+	int f, i, k;
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	for (f = 0; f < B_NFUNC; f++)
+		for (i = 0; i < 5; i++)
+			for (k = 0; k < 3; k++) {
+				host = bench_one(f, 0, sizes[i], aligns[k], BENCH_BYTES);
+				jos_string_sse2 = 0;
+				jos = bench_one(f, 1, sizes[i], aligns[k], BENCH_BYTES);
+				jos_string_sse2 = 1;
+				jos_sse2 = bench_one(f, 1, sizes[i], aligns[k], BENCH_BYTES);
+				printf("libc bench: func=%s size=%zu align=%zu host=%.0fMB/s jos=%.0fMB/s jos_sse2=%.0fMB/s\n",
+				       bench_names[f], sizes[i], aligns[k],
+				       host, jos, jos_sse2);
+			}
+	bench_fmt("%d");
+	bench_fmt("%u");
+	bench_fmt("%x");
+	bench_fmt("%s");
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "fuzz") == 0)
+		fuzz(argc >= 3 && argv[2][0] ? atol(argv[2]) : 100000);
+	else if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+		bench();
+	else {
+		fprintf(stderr, "usage: %s fuzz [iterations] | bench\n", argv[0]);
+		return 2;
+	}
+	return 0;
+}
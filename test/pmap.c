@@ -0,0 +1,156 @@
+// Native test harness for kern/pmap.c.
+//
+//	pmap check [megabytes]		run the allocator's boot-time checks
+//	pmap fuzz [operations [seed]]	fuzz page_insert, page_remove & co.
+//
+// test/pmapsim.c builds kern/pmap.c against a simulated machine, whose
+// physical memory is an arena this maps at KERNBASE.  Panics in the
+// kernel code come here, and fail the run.  Fuzzing runs twice, with
+// and without the SSE2 paths in page_zero and page_copy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/mman.h>
+
+// From inc/memlayout.h, which can't be included alongside the host's
+// headers.
+#define KERNBASE	0xF0000000
+
+// The simulated kernel image ends at 2MB (see test/Makefrag).
+#define MIN_MEM_MB	4
+#define MAX_MEM_MB	256		// to the top of the 32-bit space
+
+// Operations per fuzzed page directory, and the memory to fuzz in:
+// little, since the fuzzer keeps running out of it on purpose.
+#define FUZZ_SEQUENCE	1000
+#define FUZZ_MEM_MB	8
+
+void	sim_mem_init(void);
+void	sim_check(void);
+void	sim_fuzz(uint32_t seed, uint32_t nops);
+extern uint32_t sim_mem_mb, sim_fuzz_seed, sim_fuzz_op;
+extern _Bool jos_string_sse2;
+
+static int fuzzing;
+
+int
+cprintf(const char *fmt, ...)
+{
+	va_list ap;
+	int r;
+
+	va_start(ap, fmt);
+	r = vprintf(fmt, ap);
+	va_end(ap);
+	return r;
+}
+
+void
+_warn(const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "kernel warning at %s:%d: ", file, line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+}
+
+void
+_panic(const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	fprintf(stderr, "kernel panic at %s:%d: ", file, line);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	if (fuzzing)
+		fprintf(stderr, "fuzz seed %u, operation %u, sse2=%d\n",
+			sim_fuzz_seed, sim_fuzz_op, jos_string_sse2);
+	exit(1);
+}
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Map the simulated physical memory and build the free list.
+static void
+machine_init(unsigned mb)
+{
+	void *p;
+
+	if (mb < MIN_MEM_MB || mb > MAX_MEM_MB) {
+		fprintf(stderr, "memory must be %d to %d MB\n",
+			MIN_MEM_MB, MAX_MEM_MB);
+		exit(2);
+	}
+	p = mmap((void *) KERNBASE, (size_t) mb << 20, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p != (void *) KERNBASE) {
+		fprintf(stderr, "can't map %u MB at %#x: got %p\n",
+			mb, KERNBASE, p);
+		exit(1);
+	}
+	sim_mem_mb = mb;
+	sim_mem_init();
+}
+
+static void
+check(unsigned mb)
+{
+	double start = now_ms();
+
+	machine_init(mb);
+	sim_check();
+	printf("pmap check: mem=%uMB ms=%.1f\n", mb, now_ms() - start);
+}
+
+static void
+fuzz(long nops, uint32_t seed)
+{
+	double start = now_ms();
+	long done;
+	int sse2;
+
+	machine_init(FUZZ_MEM_MB);
+	fuzzing = 1;
+	for (sse2 = 0; sse2 <= 1; sse2++) {
+		jos_string_sse2 = sse2;
+		for (done = 0; done < nops; done += FUZZ_SEQUENCE)
+			sim_fuzz(seed + done / FUZZ_SEQUENCE,
+				 nops - done < FUZZ_SEQUENCE
+				 ? nops - done : FUZZ_SEQUENCE);
+	}
+	printf("pmap fuzz: operations=%ld seed=%u ms=%.1f\n",
+	       nops, seed, now_ms() - start);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "check") == 0)
+		check(argc >= 3 && argv[2][0] ? atoi(argv[2]) : 128);
+	else if (argc >= 2 && strcmp(argv[1], "fuzz") == 0)
+		fuzz(argc >= 3 && argv[2][0] ? atol(argv[2]) : 200000,
+		     argc >= 4 ? strtoul(argv[3], NULL, 0) : 1);
+	else {
+		fprintf(stderr, "usage: %s check [megabytes] | fuzz [operations [seed]]\n",
+			argv[0]);
+		return 2;
+	}
+	return 0;
+}
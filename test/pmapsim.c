@@ -0,0 +1,334 @@
+// kern/pmap.c, built for the host against a simulated machine.
+//
+// The machine's physical memory is an arena that test/pmap.c maps at
+// KERNBASE in the host's address space, right where the kernel keeps
+// it, so KADDR, PADDR and page2kva work unchanged.  The linker puts
+// 'end', the end of the kernel image, inside the arena (test/Makefrag),
+// and the NVRAM reports the arena's size.  What's left of the hardware
+// is the privileged instructions, which are stood in for below.
+//
+// test/Makefrag compiles this with JOS's libc renamed to jos_*, as for
+// test/libc, and links it with test/pmap.c, which holds main and
+// everything else that needs the host's C library.
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// The kernel's inc/x86.h doesn't assemble for a 64-bit host, and its
+// control register accesses would fault there anyway.  Define its guard
+// so pmap.c and kern/kclock.h get these instead.
+#define JOS_INC_X86_H
+
+uint32_t sim_cr0, sim_cr3;
+uint32_t sim_invlpgs;		// invlpg calls so far
+uintptr_t sim_invlpg_va;	// and the last one's address
+
+static inline void
+invlpg(void *addr)
+{
+	sim_invlpgs++;
+	sim_invlpg_va = (uintptr_t) addr;
+}
+
+static inline void
+lcr3(uint32_t val)
+{
+	sim_cr3 = val;
+}
+
+static inline uint32_t
+rcr0(void)
+{
+	return sim_cr0;
+}
+
+static inline void
+lcr0(uint32_t val)
+{
+	sim_cr0 = val;
+}
+
+// Interrupts are off, as they are in the kernel during mem_init, so
+// page_zero and page_copy take their SSE2 paths when string_sse2 is set.
+static inline uint32_t
+read_eflags(void)
+{
+	return 0;
+}
+
+static inline uint64_t
+read_tsc(void)
+{
+	uint32_t lo, hi;
+
+	asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return (uint64_t) hi << 32 | lo;
+}
+
+#include <kern/pmap.c>
+
+// Never used, but mem_init refers to it.
+char bootstack[KSTKSIZE];
+
+// Size of the simulated machine's memory; test/pmap.c sets it.
+uint32_t sim_mem_mb;
+
+// Only the memory size registers are simulated.
+unsigned
+mc146818_read(unsigned reg)
+{
+	uint32_t kb;
+	bool hi = reg == NVRAM_BASEHI || reg == NVRAM_EXTHI
+		|| reg == NVRAM_EXT16HI;
+
+	switch (reg) {
+	case NVRAM_BASELO:
+	case NVRAM_BASEHI:
+		kb = 640;
+		break;
+	case NVRAM_EXTLO:
+	case NVRAM_EXTHI:
+		kb = (MIN(sim_mem_mb, 16) - 1) * 1024;
+		break;
+	case NVRAM_EXT16LO:
+	case NVRAM_EXT16HI:
+		// In 64K units
+		kb = sim_mem_mb > 16 ? (sim_mem_mb - 16) * 1024 / 64 : 0;
+		break;
+	default:
+		return 0;
+	}
+	return hi ? kb >> 8 & 0xff : kb & 0xff;
+}
+
+void
+boottime_mark(const char *phase)
+{
+}
+
+void
+trace(const char *fmt, ...)
+{
+}
+
+// The part of mem_init the allocator's checks depend on: find the
+// memory, allocate kern_pgdir and pages, and build the free list.
+// Keep it in step with mem_init.
+void
+sim_mem_init(void)
+{
+	i386_detect_memory();
+	kern_pgdir = (pde_t *) boot_alloc(PGSIZE);
+	memset(kern_pgdir, 0, PGSIZE);
+	kern_pgdir[PDX(UVPT)] = PADDR(kern_pgdir) | PTE_U | PTE_P;
+	pages = (struct PageInfo *) boot_alloc(npages * sizeof(struct PageInfo));
+	memset(pages, 0, npages * sizeof(struct PageInfo));
+	page_init();
+}
+
+// The checks mem_init runs before it turns on paging.  The later ones
+// need the MMU.
+void
+sim_check(void)
+{
+	check_page_free_list(1);
+	check_page_alloc();
+	check_page();
+}
+
+
+/***** Fuzzing *****/
+
+// Pages the fuzzer maps, and the addresses it maps them at, spread over
+// a few page tables.
+#define FUZZ_NPAGES	8
+#define FUZZ_NVAS	32
+#define FUZZ_NTABLES	4
+
+// The operation being fuzzed, for failure reports.
+uint32_t sim_fuzz_seed;
+uint32_t sim_fuzz_op;
+
+static uint32_t rng;
+
+static uint32_t
+fuzz_rand(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static uint32_t
+nfree(void)
+{
+	struct PageInfo *pp;
+	uint32_t n = 0;
+
+	for (pp = page_free_list; pp; pp = pp->pp_link) {
+		assert(pp->pp_ref == 0);
+		assert(++n <= npages);
+	}
+	return n;
+}
+
+static bool
+page_is(struct PageInfo *pp, int c)
+{
+	uint8_t *p = page2kva(pp);
+	int i;
+
+	for (i = 0; i < PGSIZE; i++)
+		if (p[i] != c)
+			return 0;
+	return 1;
+}
+
+// Run 'nops' random page_insert, page_remove, page_lookup, pgdir_walk,
+// page_copy and out-of-memory operations on a fresh page directory,
+// checking the page tables and reference counts against a model after
+// each.  Then tear it all down and check that every page came back.
+void
+sim_fuzz(uint32_t seed, uint32_t nops)
+{
+	static struct PageInfo *pool[FUZZ_NPAGES];
+	static uintptr_t vas[FUZZ_NVAS];
+	static struct {
+		struct PageInfo *pp;	// mapped page, or NULL
+		int perm;
+	} model[FUZZ_NVAS];
+	struct PageInfo *pgdirpp, *stash = NULL, *pp;
+	uint32_t free0, ntables = 0, invlpgs, i, j, k;
+	pde_t *pgdir;
+	pte_t *pte;
+	bool has_table;
+	int perm, r;
+
+	sim_fuzz_seed = rng = seed ? seed : 1;
+	free0 = nfree();
+
+	assert((pgdirpp = page_alloc(ALLOC_ZERO)));
+	assert(page_is(pgdirpp, 0));
+	pgdirpp->pp_ref++;
+	pgdir = page2kva(pgdirpp);
+	for (i = 0; i < FUZZ_NPAGES; i++) {
+		// Held by the fuzzer, so unmapping never frees them
+		assert((pool[i] = page_alloc(ALLOC_ZERO)));
+		assert(page_is(pool[i], 0));
+		pool[i]->pp_ref = 1;
+	}
+	for (i = 0; i < FUZZ_NVAS; i++) {
+		do {
+			vas[i] = (fuzz_rand() % FUZZ_NTABLES) * PTSIZE
+				+ (fuzz_rand() % NPTENTRIES) * PGSIZE;
+			for (j = 0; j < i && vas[j] != vas[i]; j++)
+				;
+		} while (j < i);
+		model[i].pp = NULL;
+	}
+
+	for (sim_fuzz_op = 0; sim_fuzz_op < nops; sim_fuzz_op++) {
+		i = fuzz_rand() % FUZZ_NVAS;
+		j = fuzz_rand() % FUZZ_NPAGES;
+		has_table = pgdir[PDX(vas[i])] & PTE_P;
+
+		invlpgs = sim_invlpgs;
+		switch (fuzz_rand() % 16) {
+		case 0 ... 5:
+			perm = fuzz_rand() & (PTE_W | PTE_U);
+			r = page_insert(pgdir, pool[j], (void *) vas[i], perm);
+			if (!has_table && !page_free_list) {
+				assert(r == -E_NO_MEM);
+				break;
+			}
+			assert(r == 0);
+			ntables += !has_table;
+			// The old mapping, if any, must be flushed
+			if (model[i].pp)
+				assert(sim_invlpgs == invlpgs + 1
+				       && sim_invlpg_va == vas[i]);
+			model[i].pp = pool[j];
+			model[i].perm = perm;
+			break;
+		case 6 ... 9:
+			page_remove(pgdir, (void *) vas[i]);
+			if (model[i].pp)
+				assert(sim_invlpgs == invlpgs + 1
+				       && sim_invlpg_va == vas[i]);
+			else
+				assert(sim_invlpgs == invlpgs);
+			model[i].pp = NULL;
+			break;
+		case 10 ... 12:
+			r = fuzz_rand() % 2;
+			pte = pgdir_walk(pgdir, (void *) vas[i], r);
+			if (has_table) {
+				assert(pte == (pte_t *) KADDR(PTE_ADDR(pgdir[PDX(vas[i])]))
+				       + PTX(vas[i]));
+			} else if (r && page_free_list) {
+				assert(pte && (pgdir[PDX(vas[i])] & PTE_P));
+				ntables++;
+			} else
+				assert(pte == NULL);
+			break;
+		case 13:
+			k = fuzz_rand() % FUZZ_NPAGES;
+			memset(page2kva(pool[k]), fuzz_rand(), PGSIZE);
+			page_copy(pool[j], pool[k]);
+			assert(memcmp(page2kva(pool[j]), page2kva(pool[k]), PGSIZE) == 0);
+			break;
+		case 14:
+			// Run out of memory, so new page tables fail
+			while ((pp = page_alloc(0))) {
+				pp->pp_link = stash;
+				stash = pp;
+			}
+			break;
+		case 15:
+			while ((pp = stash)) {
+				stash = pp->pp_link;
+				pp->pp_link = NULL;
+				page_free(pp);
+			}
+			break;
+		}
+
+		// Check the whole model; it's small
+		for (k = 0; k < FUZZ_NVAS; k++) {
+			pp = page_lookup(pgdir, (void *) vas[k], &pte);
+			assert(pp == model[k].pp);
+			if (pp)
+				assert(*pte == (page2pa(pp) | model[k].perm | PTE_P));
+		}
+		for (j = 0; j < FUZZ_NPAGES; j++) {
+			for (r = 1, k = 0; k < FUZZ_NVAS; k++)
+				r += model[k].pp == pool[j];
+			assert(pool[j]->pp_ref == r);
+		}
+	}
+
+	// Tear down, dirtying the pages so ALLOC_ZERO has work next time
+	for (i = 0; i < FUZZ_NVAS; i++)
+		page_remove(pgdir, (void *) vas[i]);
+	for (i = 0; i < FUZZ_NPAGES; i++) {
+		assert(pool[i]->pp_ref == 1);
+		memset(page2kva(pool[i]), 0xa5, PGSIZE);
+		page_decref(pool[i]);
+	}
+	while ((pp = stash)) {
+		stash = pp->pp_link;
+		pp->pp_link = NULL;
+		page_free(pp);
+	}
+	for (i = 0, k = 0; i < NPDENTRIES; i++)
+		if (pgdir[i] & PTE_P) {
+			pp = pa2page(PTE_ADDR(pgdir[i]));
+			assert(pp->pp_ref == 1);
+			page_decref(pp);
+			k++;
+		}
+	assert(k == ntables);
+	page_decref(pgdirpp);
+	assert(nfree() == free0);
+}